@@ -0,0 +1,348 @@
+/* libUIOHook: Cross-platform keyboard and mouse hooking from userland.
+ * Copyright (C) 2006-2020 Alexander Barker.  All Rights Received.
+ * https://github.com/kwhat/libuiohook/
+ *
+ * libUIOHook is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libUIOHook is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the hook backend this library was built with.  Pointer motion is
+ * posted with hook_post_event() at a fixed rate and matched to the events the
+ * hook dispatches, which gives the latency from posting to dispatch and the
+ * hook thread CPU time per event.  The hook thread's context switches are then
+ * counted over an idle period.  Run it under Xvfb with no other input, once per
+ * build configuration, for example:
+ *
+ *   xvfb-run -s "-screen 0 1024x768x24" ./demo_bench 5000 1000
+ *
+ * with USE_XRECORD_ASYNC on and off, USE_XINPUT2 and USE_XCB_RECORD.  A rate
+ * of 0 posts every sample in one hook_post_events() batch instead, and reports
+ * how fast the hook keeps up with a burst.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <uiohook.h>
+#include <unistd.h>
+
+// Posted positions walk a grid so every sample has a distinct position.
+#define BENCH_ORIGIN 100
+#define BENCH_GRID 200
+#define BENCH_MAX_SAMPLES (BENCH_GRID * BENCH_GRID)
+
+// How long to wait for the last events and how long to sit idle.
+#define BENCH_DRAIN_MS 1000
+#define BENCH_IDLE_MS 2000
+
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bench_cond = PTHREAD_COND_INITIALIZER;
+static bool hook_enabled = false;
+static int hook_status = UIOHOOK_SUCCESS;
+static bool hook_done = false;
+static pid_t hook_tid = 0;
+
+static size_t sample_count = 0;
+static int64_t *posted_ns = NULL;
+static int64_t *latency_ns = NULL;
+static size_t received = 0;
+static int64_t last_received_ns = 0;
+static size_t unmatched = 0;
+
+// Offset between posted and reported positions, set by the first sample.
+static bool has_offset = false;
+static int offset_x, offset_y;
+
+// Hook thread CPU time at the first and last matched sample.
+static int64_t first_cpu_ns = -1, last_cpu_ns = -1;
+static size_t first_cpu_sample, last_cpu_sample;
+
+static int64_t get_time_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+bool logger_proc(unsigned int level, const char *format, ...) {
+    bool status = false;
+
+    va_list args;
+    switch (level) {
+        case LOG_LEVEL_WARN:
+        case LOG_LEVEL_ERROR:
+            va_start(args, format);
+            status = vfprintf(stderr, format, args) >= 0;
+            va_end(args);
+            break;
+    }
+
+    return status;
+}
+
+// Runs on the hook thread in DISPATCH_MODE_SYNC, so it must stay cheap.
+void dispatch_proc(uiohook_event * const event, void* capture) {
+    int64_t now = get_time_ns(CLOCK_MONOTONIC);
+
+    switch (event->type) {
+        case EVENT_HOOK_ENABLED:
+            pthread_mutex_lock(&bench_mutex);
+            hook_tid = (pid_t) syscall(SYS_gettid);
+            hook_enabled = true;
+            pthread_cond_signal(&bench_cond);
+            pthread_mutex_unlock(&bench_mutex);
+            break;
+
+        case EVENT_MOUSE_MOVED:
+        case EVENT_MOUSE_DRAGGED:
+            pthread_mutex_lock(&bench_mutex);
+            if (!has_offset) {
+                offset_x = event->data.mouse.x - BENCH_ORIGIN;
+                offset_y = event->data.mouse.y - BENCH_ORIGIN;
+                has_offset = true;
+            }
+
+            int column = event->data.mouse.x - offset_x - BENCH_ORIGIN;
+            int row = event->data.mouse.y - offset_y - BENCH_ORIGIN;
+            size_t sample = (size_t) row * BENCH_GRID + column;
+            if (column >= 0 && column < BENCH_GRID && row >= 0 && row < BENCH_GRID
+                    && sample < sample_count && posted_ns[sample] != 0 && latency_ns[sample] < 0) {
+                latency_ns[sample] = now - posted_ns[sample];
+                last_received_ns = now;
+                received++;
+
+                int64_t cpu = get_time_ns(CLOCK_THREAD_CPUTIME_ID);
+                if (first_cpu_ns < 0) {
+                    first_cpu_ns = cpu;
+                    first_cpu_sample = received;
+                }
+                last_cpu_ns = cpu;
+                last_cpu_sample = received;
+            } else {
+                unmatched++;
+            }
+            pthread_mutex_unlock(&bench_mutex);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void *hook_thread_proc(void *arg) {
+    int status = hook_run();
+
+    pthread_mutex_lock(&bench_mutex);
+    hook_status = status;
+    hook_done = true;
+    pthread_cond_signal(&bench_cond);
+    pthread_mutex_unlock(&bench_mutex);
+
+    return NULL;
+}
+
+// Voluntary and involuntary context switches of a thread, or -1 if unknown.
+static long get_context_switches(pid_t tid) {
+    long switches = -1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int) tid);
+
+    FILE *status = fopen(path, "r");
+    if (status != NULL) {
+        char line[128];
+        long value;
+        switches = 0;
+        while (fgets(line, sizeof(line), status) != NULL) {
+            if (sscanf(line, "voluntary_ctxt_switches: %ld", &value) == 1
+                    || sscanf(line, "nonvoluntary_ctxt_switches: %ld", &value) == 1) {
+                switches += value;
+            }
+        }
+        fclose(status);
+    }
+
+    return switches;
+}
+
+static void sleep_until(int64_t deadline) {
+    struct timespec ts = {
+        .tv_sec = deadline / 1000000000,
+        .tv_nsec = deadline % 1000000000
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0) { }
+}
+
+static int compare_int64(const void *a, const void *b) {
+    int64_t left = *(const int64_t *) a;
+    int64_t right = *(const int64_t *) b;
+
+    return (left > right) - (left < right);
+}
+
+int main(int argc, char *argv[]) {
+    sample_count = argc > 1 ? strtoul(argv[1], NULL, 10) : 5000;
+    unsigned long rate = argc > 2 ? strtoul(argv[2], NULL, 10) : 1000;
+    if (sample_count < 2 || sample_count > BENCH_MAX_SAMPLES) {
+        fprintf(stderr, "Usage: %s [samples 2-%d] [rate in Hz, 0 for a burst]\n", argv[0], BENCH_MAX_SAMPLES);
+        return 1;
+    }
+
+    posted_ns = calloc(sample_count, sizeof(int64_t));
+    latency_ns = malloc(sample_count * sizeof(int64_t));
+    uiohook_event *burst = rate == 0 ? calloc(sample_count, sizeof(uiohook_event)) : NULL;
+    if (posted_ns == NULL || latency_ns == NULL || (rate == 0 && burst == NULL)) {
+        fprintf(stderr, "Failed to allocate memory for %zu samples!\n", sample_count);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sample_count; i++) {
+        latency_ns[i] = -1;
+    }
+
+    hook_set_logger_proc(&logger_proc);
+    hook_set_dispatch_proc(&dispatch_proc, NULL);
+
+    // Park the pointer away from the grid so the first sample is a real move.
+    uiohook_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_MOUSE_MOVED;
+    event.data.mouse.x = BENCH_ORIGIN / 2;
+    event.data.mouse.y = BENCH_ORIGIN / 2;
+    hook_post_event(&event);
+
+    pthread_t hook_thread;
+    if (pthread_create(&hook_thread, NULL, hook_thread_proc, NULL) != 0) {
+        fprintf(stderr, "Failed to create the hook thread!\n");
+        return 1;
+    }
+
+    pthread_mutex_lock(&bench_mutex);
+    while (!hook_enabled && !hook_done) {
+        pthread_cond_wait(&bench_cond, &bench_mutex);
+    }
+    bool is_running = hook_enabled && !hook_done;
+    pthread_mutex_unlock(&bench_mutex);
+
+    if (!is_running) {
+        pthread_join(hook_thread, NULL);
+        fprintf(stderr, "The hook failed to start! (%#X)\n", hook_status);
+        return 1;
+    }
+
+    int64_t start = get_time_ns(CLOCK_MONOTONIC);
+    if (rate == 0) {
+        // Post every sample at once, each to the next cell of the grid.
+        for (size_t i = 0; i < sample_count; i++) {
+            burst[i] = event;
+            burst[i].data.mouse.x = (int16_t) (BENCH_ORIGIN + i % BENCH_GRID);
+            burst[i].data.mouse.y = (int16_t) (BENCH_ORIGIN + i / BENCH_GRID);
+        }
+
+        pthread_mutex_lock(&bench_mutex);
+        start = get_time_ns(CLOCK_MONOTONIC);
+        for (size_t i = 0; i < sample_count; i++) {
+            posted_ns[i] = start;
+        }
+        pthread_mutex_unlock(&bench_mutex);
+
+        hook_post_events(burst, sample_count, POST_NO_SYNC);
+    } else {
+        // Post one sample per period, each to the next cell of the grid.
+        int64_t period = 1000000000 / (int64_t) rate;
+        for (size_t i = 0; i < sample_count; i++) {
+            sleep_until(start + (int64_t) i * period);
+
+            event.data.mouse.x = (int16_t) (BENCH_ORIGIN + i % BENCH_GRID);
+            event.data.mouse.y = (int16_t) (BENCH_ORIGIN + i / BENCH_GRID);
+
+            pthread_mutex_lock(&bench_mutex);
+            posted_ns[i] = get_time_ns(CLOCK_MONOTONIC);
+            pthread_mutex_unlock(&bench_mutex);
+
+            hook_post_event(&event);
+        }
+    }
+
+    sleep_until(get_time_ns(CLOCK_MONOTONIC) + (int64_t) BENCH_DRAIN_MS * 1000000);
+
+    // Count the hook thread's wakeups while nothing happens.
+    long idle_switches = get_context_switches(hook_tid);
+    sleep_until(get_time_ns(CLOCK_MONOTONIC) + (int64_t) BENCH_IDLE_MS * 1000000);
+    if (idle_switches >= 0) {
+        idle_switches = get_context_switches(hook_tid) - idle_switches;
+    }
+
+    hook_stop();
+    pthread_join(hook_thread, NULL);
+
+    // Summarize the matched samples.
+    pthread_mutex_lock(&bench_mutex);
+    size_t count = 0;
+    for (size_t i = 0; i < sample_count; i++) {
+        if (latency_ns[i] >= 0) {
+            latency_ns[count++] = latency_ns[i];
+        }
+    }
+
+    if (rate == 0) {
+        printf("Samples:        %zu posted in a burst, %zu received, %zu unmatched\n",
+                sample_count, received, unmatched);
+
+        if (received > 0 && last_received_ns > start) {
+            printf("Throughput:     %.0f events/s\n",
+                    (double) received * 1000000000.0 / (double) (last_received_ns - start));
+        }
+    } else {
+        printf("Samples:        %zu posted at %lu Hz, %zu received, %zu unmatched\n",
+                sample_count, rate, received, unmatched);
+    }
+
+    if (count > 0) {
+        qsort(latency_ns, count, sizeof(int64_t), compare_int64);
+
+        printf("Latency (us):   min %" PRId64 ", median %" PRId64 ", p95 %" PRId64 ", p99 %" PRId64 ", max %" PRId64 "\n",
+                latency_ns[0] / 1000,
+                latency_ns[count / 2] / 1000,
+                latency_ns[count * 95 / 100] / 1000,
+                latency_ns[count * 99 / 100] / 1000,
+                latency_ns[count - 1] / 1000);
+    }
+
+    if (last_cpu_sample > first_cpu_sample) {
+        printf("Hook CPU (us):  %.2f per event\n",
+                (double) (last_cpu_ns - first_cpu_ns) / 1000.0 / (double) (last_cpu_sample - first_cpu_sample));
+    }
+
+    if (idle_switches >= 0) {
+        printf("Idle wakeups:   %ld in %d ms\n", idle_switches, BENCH_IDLE_MS);
+    }
+    pthread_mutex_unlock(&bench_mutex);
+
+    free(burst);
+    free(posted_ns);
+    free(latency_ns);
+
+    return 0;
+}
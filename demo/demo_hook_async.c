@@ -85,7 +85,8 @@ bool logger_proc(unsigned int level, const char *format, ...) {
 // event dispatcher and may delay event delivery to the target application.
 // Furthermore, some operating systems may choose to disable your hook if it 
 // takes too long to process.  If you need to do any extended processing, please 
-// do so by copying the event to your own queued dispatch thread.
+// do so by copying the event to your own queued dispatch thread.  On X11, the
+// DISPATCH_MODE_ASYNC option of hook_set_dispatch_mode() provides such a thread.
 void dispatch_proc(uiohook_event * const event, void* capture) {
     char buffer[256] = { 0 };
     size_t length = snprintf(buffer, sizeof(buffer), 
@@ -0,0 +1,126 @@
+/* libUIOHook: Cross-platform keyboard and mouse hooking from userland.
+ * Copyright (C) 2006-2020 Alexander Barker.  All Rights Received.
+ * https://github.com/kwhat/libuiohook/
+ *
+ * libUIOHook is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libUIOHook is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <uiohook.h>
+
+// Cleared when EVENT_HOOK_DISABLED is delivered.
+static bool running = true;
+
+bool logger_proc(unsigned int level, const char *format, ...) {
+    bool status = false;
+
+    va_list args;
+    switch (level) {
+        case LOG_LEVEL_INFO:
+            va_start(args, format);
+            status = vfprintf(stdout, format, args) >= 0;
+            va_end(args);
+            break;
+
+        case LOG_LEVEL_WARN:
+        case LOG_LEVEL_ERROR:
+            va_start(args, format);
+            status = vfprintf(stderr, format, args) >= 0;
+            va_end(args);
+            break;
+    }
+
+    return status;
+}
+
+// NOTE: The following callback executes inside hook_process_pending().  Calling
+// hook_stop() from here only marks the hook for removal, hook_process_pending()
+// delivers the remaining events and withdraws the hook before it returns.
+void dispatch_proc(uiohook_event * const event, void *user_data) {
+    switch (event->type) {
+        case EVENT_HOOK_ENABLED:
+            fprintf(stdout, "Hook enabled, press escape to stop.\n");
+            break;
+
+        case EVENT_HOOK_DISABLED:
+            fprintf(stdout, "Hook disabled.\n");
+            running = false;
+            break;
+
+        case EVENT_KEY_PRESSED:
+            fprintf(stdout, "id=%i,when=%" PRIu64 ",keycode=%u\n",
+                    event->type, event->time, event->data.keyboard.keycode);
+
+            if (event->data.keyboard.keycode == VC_ESCAPE) {
+                int status = hook_stop();
+                if (status != UIOHOOK_SUCCESS) {
+                    logger_proc(LOG_LEVEL_ERROR, "Failed to stop the hook. (%#X)\n", status);
+                }
+            }
+            break;
+
+        case EVENT_MOUSE_PRESSED:
+            fprintf(stdout, "id=%i,when=%" PRIu64 ",x=%i,y=%i,button=%i\n",
+                    event->type, event->time, event->data.mouse.x, event->data.mouse.y,
+                    event->data.mouse.button);
+            break;
+
+        default:
+            break;
+    }
+}
+
+int main() {
+    hook_set_logger_proc(&logger_proc);
+    hook_set_dispatch_proc(&dispatch_proc, NULL);
+
+    struct pollfd fds = { .fd = -1, .events = POLLIN };
+    int status = hook_start_nonblocking(&fds.fd);
+    if (status != UIOHOOK_SUCCESS) {
+        logger_proc(LOG_LEVEL_ERROR, "Failed to start the hook. (%#X)\n", status);
+        return status;
+    }
+
+    // Stand in for the application event loop.
+    while (running) {
+        if (poll(&fds, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            logger_proc(LOG_LEVEL_ERROR, "Failed to poll the hook. (%d)\n", errno);
+            hook_stop();
+            status = UIOHOOK_FAILURE;
+            break;
+        }
+
+        // Returns after the hook was withdrawn if the dispatcher called hook_stop().
+        status = hook_process_pending();
+        if (status != UIOHOOK_SUCCESS) {
+            logger_proc(LOG_LEVEL_ERROR, "Failed to process the hook events. (%#X)\n", status);
+            break;
+        }
+    }
+
+    return status;
+}
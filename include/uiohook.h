@@ -21,6 +21,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /* Begin Error Codes */
@@ -85,6 +86,11 @@ typedef struct _screen_data {
     uint16_t height;
 } screen_data;
 
+typedef struct _path_point {
+    int16_t x;
+    int16_t y;
+} path_point;
+
 typedef struct _keyboard_event_data {
     uint16_t keycode;
     uint16_t rawcode;
@@ -99,6 +105,8 @@ typedef struct _mouse_event_data {
     uint16_t clicks;
     int16_t x;
     int16_t y;
+    int16_t delta_x;
+    int16_t delta_y;
 } mouse_event_data,
         mouse_pressed_event_data,
         mouse_released_event_data,
@@ -127,9 +135,53 @@ typedef struct _uiohook_event {
 } uiohook_event;
 
 typedef void (*dispatcher_t)(uiohook_event *const, void* capture);
+typedef void (*batch_dispatcher_t)(uiohook_event *const, size_t count, void* capture);
 /* End Virtual Event Types and Data Structures */
 
 
+/* Begin Event Type Masks */
+#define EVENT_MASK(type)                         (1U << (type))
+
+#define EVENT_MASK_HOOK                          (EVENT_MASK(EVENT_HOOK_ENABLED) | EVENT_MASK(EVENT_HOOK_DISABLED))
+#define EVENT_MASK_KEYBOARD                      (EVENT_MASK(EVENT_KEY_TYPED) | EVENT_MASK(EVENT_KEY_PRESSED) | EVENT_MASK(EVENT_KEY_RELEASED))
+#define EVENT_MASK_MOUSE_BUTTON                  (EVENT_MASK(EVENT_MOUSE_CLICKED) | EVENT_MASK(EVENT_MOUSE_PRESSED) | EVENT_MASK(EVENT_MOUSE_RELEASED))
+#define EVENT_MASK_MOUSE_MOTION                  (EVENT_MASK(EVENT_MOUSE_MOVED) | EVENT_MASK(EVENT_MOUSE_DRAGGED))
+#define EVENT_MASK_MOUSE_WHEEL                   (EVENT_MASK(EVENT_MOUSE_WHEEL))
+#define EVENT_MASK_MOUSE                         (EVENT_MASK_MOUSE_BUTTON | EVENT_MASK_MOUSE_MOTION | EVENT_MASK_MOUSE_WHEEL)
+#define EVENT_MASK_ALL                           (EVENT_MASK_HOOK | EVENT_MASK_KEYBOARD | EVENT_MASK_MOUSE)
+/* End Event Type Masks */
+
+
+/* Begin Dispatch Modes and Statistics */
+#define DISPATCH_MODE_SYNC                       0x00    // Dispatch on the hook thread
+#define DISPATCH_MODE_ASYNC                      0x01    // Dispatch on a library owned thread
+#define DISPATCH_MODE_POLL                       0x02    // Queue events for hook_poll_events()
+
+typedef struct _dispatch_stats {
+    uint32_t capacity;
+    uint32_t occupancy;
+    uint64_t overflow;
+} dispatch_stats;
+/* End Dispatch Modes and Statistics */
+
+
+/* Begin Coalescing Flags */
+#define COALESCE_MOUSE_MOTION                    0x01    // Merge consecutive moved or dragged events
+#define COALESCE_MOUSE_WHEEL                     0x02    // Merge consecutive same direction wheel events
+/* End Coalescing Flags */
+
+
+/* Begin Post Flags */
+#define POST_NO_SYNC                             0x01    // Queue posted events and return without waiting for them
+/* End Post Flags */
+
+
+/* Begin Pointer Path Types */
+#define PATH_POLYLINE                            0x00    // Straight segments through every point at constant speed
+#define PATH_BEZIER                              0x01    // One Bezier curve with the points as control points
+/* End Pointer Path Types */
+
+
 /* Begin Virtual Key Codes */
 #define VC_ESCAPE                                0x0001
 
@@ -414,18 +466,71 @@ typedef void (*dispatcher_t)(uiohook_event *const, void* capture);
 extern "C" {
 #endif
 
+    /* Batch posting, playback, paths and text, batch and subscriber dispatch, the
+     * dispatch modes, polling, coalescing, nonblocking hooks and evdev are only
+     * implemented on X11.  Other platforms define them so applications link, but
+     * they return UIOHOOK_FAILURE or do nothing, see each manual page.
+     */
+
     // Set the logger callback functions.
     UIOHOOK_API void hook_set_logger_proc(logger_t logger_proc);
 
     // Send a virtual event back to the system.
     UIOHOOK_API void hook_post_event(uiohook_event * const event);
 
+    // Send an array of virtual events back to the system in one batch.
+    UIOHOOK_API void hook_post_events(uiohook_event * const events, size_t count, uint8_t flags);
+
+    // Send an array of virtual events back to the system with their recorded timing.
+    UIOHOOK_API int hook_play_events(uiohook_event * const events, size_t count, double speed, int64_t *errors);
+
+    // Move the pointer along a path at a fixed sample rate, dragging if mask holds buttons.
+    UIOHOOK_API int hook_post_mouse_path(const path_point *points, size_t count, uint8_t type, uint32_t rate, uint32_t duration_ms, uint16_t mask);
+
+    // Type a UTF-8 string with the current keyboard layout.
+    // Characters missing from the layout are typed by briefly changing the
+    // keyboard mapping of unused key codes, which every X11 client sees.
+    UIOHOOK_API int hook_post_text(const char *utf8);
+
     // Set the event callback function.
     UIOHOOK_API void hook_set_dispatch_proc(dispatcher_t dispatch_proc, void* capture);
 
+    // Set the callback function that receives events in batches.
+    UIOHOOK_API void hook_set_batch_dispatch_proc(batch_dispatcher_t dispatch_proc, void* capture);
+
+    // Set which queued mouse events are merged before they are dispatched.
+    // Fails in DISPATCH_MODE_SYNC with the synchronous XRecord backend.
+    UIOHOOK_API int hook_set_coalescing(uint8_t flags, uint32_t window_ms, uint32_t max_events);
+
+    // Add an event callback function for the event types in mask.
+    UIOHOOK_API int hook_add_dispatch_proc(dispatcher_t dispatch_proc, void* capture, uint32_t mask);
+
+    // Remove an event callback function added with hook_add_dispatch_proc.
+    UIOHOOK_API int hook_remove_dispatch_proc(dispatcher_t dispatch_proc, void* capture);
+
+    // Set the thread used to call the event callback function.
+    // Fails while the hook is running or another thread is in hook_poll_events().
+    UIOHOOK_API int hook_set_dispatch_mode(uint8_t mode, uint32_t capacity);
+
+    // Retrieves the asynchronous dispatch queue statistics.
+    UIOHOOK_API void hook_get_dispatch_stats(dispatch_stats *stats);
+
+    // Copy up to cap queued events into buffer, waiting up to timeout_ms for the first one.
+    // Exactly one thread may call this function, a concurrent call returns 0.
+    UIOHOOK_API size_t hook_poll_events(uiohook_event *const buffer, size_t cap, int timeout_ms);
+
     // Insert the event hook.
     UIOHOOK_API int hook_run();
 
+    // Insert the event hook on Linux input devices, or on fds carrying input_event records.
+    UIOHOOK_API int hook_run_evdev(const int *fds, size_t count);
+
+    // Insert the event hook without blocking, fd receives a descriptor to poll for input.
+    UIOHOOK_API int hook_start_nonblocking(int *fd);
+
+    // Dispatch the events that are ready after hook_start_nonblocking().
+    UIOHOOK_API int hook_process_pending();
+
     // Withdraw the event hook.
     UIOHOOK_API int hook_stop();
 
@@ -790,6 +790,8 @@ static inline void process_button_pressed(uint64_t timestamp, CGEventRef event_r
     event.data.mouse.clicks = click_count;
     event.data.mouse.x = event_point.x;
     event.data.mouse.y = event_point.y;
+    event.data.mouse.delta_x = 0;
+    event.data.mouse.delta_y = 0;
 
     logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u pressed %u time(s). (%u, %u)\n",
             __FUNCTION__, __LINE__, event.data.mouse.button, event.data.mouse.clicks,
@@ -813,6 +815,8 @@ static inline void process_button_released(uint64_t timestamp, CGEventRef event_
     event.data.mouse.clicks = click_count;
     event.data.mouse.x = event_point.x;
     event.data.mouse.y = event_point.y;
+    event.data.mouse.delta_x = 0;
+    event.data.mouse.delta_y = 0;
 
     logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u released %u time(s). (%u, %u)\n",
             __FUNCTION__, __LINE__, event.data.mouse.button, event.data.mouse.clicks,
@@ -834,6 +838,8 @@ static inline void process_button_released(uint64_t timestamp, CGEventRef event_
         event.data.mouse.clicks = click_count;
         event.data.mouse.x = event_point.x;
         event.data.mouse.y = event_point.y;
+        event.data.mouse.delta_x = 0;
+        event.data.mouse.delta_y = 0;
 
         logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u clicked %u time(s). (%u, %u)\n",
                 __FUNCTION__, __LINE__, event.data.mouse.button, event.data.mouse.clicks,
@@ -874,6 +880,8 @@ static inline void process_mouse_moved(uint64_t timestamp, CGEventRef event_ref)
     event.data.mouse.clicks = click_count;
     event.data.mouse.x = event_point.x;
     event.data.mouse.y = event_point.y;
+    event.data.mouse.delta_x = 0;
+    event.data.mouse.delta_y = 0;
 
     logger(LOG_LEVEL_DEBUG, "%s [%u]: Mouse %s to %u, %u.\n",
             __FUNCTION__, __LINE__, mouse_dragged ? "dragged" : "moved",
@@ -1332,3 +1340,78 @@ UIOHOOK_API int hook_stop() {
 
     return status;
 }
+
+/* The functions below are only implemented on X11.  They are defined here so
+ * applications built against uiohook.h link on every platform, and they fail
+ * without doing anything.
+ */
+UIOHOOK_API void hook_set_batch_dispatch_proc(batch_dispatcher_t dispatch_proc, void* capture) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+}
+
+UIOHOOK_API int hook_set_coalescing(uint8_t flags, uint32_t window_ms, uint32_t max_events) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+
+UIOHOOK_API int hook_add_dispatch_proc(dispatcher_t dispatch_proc, void* capture, uint32_t mask) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+
+UIOHOOK_API int hook_remove_dispatch_proc(dispatcher_t dispatch_proc, void* capture) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+
+UIOHOOK_API int hook_set_dispatch_mode(uint8_t mode, uint32_t capacity) {
+    int status = UIOHOOK_FAILURE;
+
+    // Events are always dispatched on the hook thread here.
+    if (mode == DISPATCH_MODE_SYNC) {
+        status = UIOHOOK_SUCCESS;
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Only DISPATCH_MODE_SYNC is available on this platform!\n",
+                __FUNCTION__, __LINE__);
+    }
+
+    return status;
+}
+
+UIOHOOK_API void hook_get_dispatch_stats(dispatch_stats *stats) {
+    stats->capacity = 0;
+    stats->occupancy = 0;
+    stats->overflow = 0;
+}
+
+UIOHOOK_API size_t hook_poll_events(uiohook_event *const buffer, size_t cap, int timeout_ms) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return 0;
+}
+
+UIOHOOK_API int hook_run_evdev(const int *fds, size_t count) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+
+UIOHOOK_API int hook_start_nonblocking(int *fd) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+
+UIOHOOK_API int hook_process_pending() {
+    return UIOHOOK_FAILURE;
+}
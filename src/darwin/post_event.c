@@ -237,3 +237,35 @@ UIOHOOK_API void hook_post_event(uiohook_event * const event) {
             break;
     }
 }
+
+// Batches are not supported here, post the events one at a time.
+UIOHOOK_API void hook_post_events(uiohook_event * const events, size_t count, uint8_t flags) {
+    for (size_t i = 0; i < count; i++) {
+        hook_post_event(&events[i]);
+    }
+}
+
+/* The functions below are only implemented on X11.  They are defined here so
+ * applications built against uiohook.h link on every platform, and they fail
+ * without posting anything.
+ */
+UIOHOOK_API int hook_play_events(uiohook_event * const events, size_t count, double speed, int64_t *errors) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+
+UIOHOOK_API int hook_post_mouse_path(const path_point *points, size_t count, uint8_t type, uint32_t rate, uint32_t duration_ms, uint16_t mask) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+
+UIOHOOK_API int hook_post_text(const char *utf8) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: This function is only available on X11!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
@@ -25,10 +25,12 @@
 
 #ifdef USE_EVDEV
 #include <linux/input.h>
+// Read with atomics, key codes are translated on posting threads during a reload.
 static bool is_evdev = false;
 #endif
 
 #include <X11/XKBlib.h>
+// Replaced by load_input_helper() only after the new map is complete.
 static XkbDescPtr keyboard_map;
 
 #ifdef USE_XKB_COMMON
@@ -46,9 +48,26 @@ static struct xkb_rule_names xkb_names = {
     .options = NULL
 };
 #endif
+
+#ifdef USE_XKB_CACHE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <time.h>
 #endif
 
 #include "logger.h"
+#include "input_helper.h"
+
+// Key descriptors indexed by X11 key code, built by load_input_helper().
+static key_descriptor key_descriptors[KEY_DESCRIPTOR_COUNT];
+#ifdef USE_EVDEV
+static key_descriptor evdev_key_descriptors[KEY_DESCRIPTOR_COUNT];
+#endif
 
 /* The follwoing two tables are based on QEMU's x_keymap.c, under the following
  * terms:
@@ -1558,7 +1577,7 @@ uint16_t keycode_to_scancode(KeyCode keycode) {
 
     #ifdef USE_EVDEV
     // Check to see if evdev is available.
-    if (is_evdev) {
+    if (__atomic_load_n(&is_evdev, __ATOMIC_RELAXED)) {
         unsigned short evdev_size = sizeof(evdev_scancode_table) / sizeof(evdev_scancode_table[0]);
 
         // NOTE scancodes < 97 appear to be identical between Evdev and XFree86.
@@ -1592,7 +1611,7 @@ KeyCode scancode_to_keycode(uint16_t scancode) {
 
     #ifdef USE_EVDEV
     // Check to see if evdev is available.
-    if (is_evdev) {
+    if (__atomic_load_n(&is_evdev, __ATOMIC_RELAXED)) {
         unsigned short evdev_size = sizeof(evdev_scancode_table) / sizeof(evdev_scancode_table[0]);
 
         // NOTE scancodes < 97 appear to be identical between Evdev and XFree86.
@@ -1637,13 +1656,256 @@ KeyCode scancode_to_keycode(uint16_t scancode) {
 }
 
 #ifdef USE_XKB_COMMON
+/* Memoized key symbols and characters, a few modifier and layout states per key
+ * code.  Replaying macros presses the same keys in the same few states, which
+ * makes the xkbcommon keymap walks in xkb_state_key_get_one_sym() and
+ * xkb_state_key_get_utf32() the bulk of the per-key cost.
+ */
+#define KEYSYM_CACHE_WAYS 4
+static struct _keysym_cache {
+    struct _keysym_way {
+        xkb_mod_mask_t mods;
+        xkb_layout_index_t layout;
+        bool is_valid;
+        keysym_entry entry;
+    } ways[KEYSYM_CACHE_WAYS];
+    uint8_t next;
+} keysym_cache[KEY_DESCRIPTOR_COUNT];
+
+static const keysym_entry empty_keysym_entry = { NoSymbol, { 0x0000, 0x0000 }, 0 };
+
+static void flush_keysym_cache() {
+    memset(keysym_cache, 0, sizeof(keysym_cache));
+}
+
+const keysym_entry * keycode_to_keysym_entry(struct xkb_state* state, KeyCode keycode) {
+    const keysym_entry *entry = &empty_keysym_entry;
+
+    if (state != NULL) {
+        xkb_mod_mask_t mods = xkb_state_serialize_mods(state, XKB_STATE_MODS_EFFECTIVE);
+        xkb_layout_index_t layout = xkb_state_serialize_layout(state, XKB_STATE_LAYOUT_EFFECTIVE);
+
+        struct _keysym_cache *key = &keysym_cache[keycode];
+        for (unsigned int i = 0; i < KEYSYM_CACHE_WAYS && entry == &empty_keysym_entry; i++) {
+            if (key->ways[i].is_valid && key->ways[i].mods == mods && key->ways[i].layout == layout) {
+                entry = &key->ways[i].entry;
+            }
+        }
+
+        if (entry == &empty_keysym_entry) {
+            // Replace the ways in turn, there are rarely more states than ways.
+            struct _keysym_way *way = &key->ways[key->next];
+            key->next = (key->next + 1) % KEYSYM_CACHE_WAYS;
+
+            way->mods = mods;
+            way->layout = layout;
+            way->is_valid = true;
+            way->entry.keysym = xkb_state_key_get_one_sym(state, keycode);
+            way->entry.count = keycode_to_unicode(state, keycode, way->entry.unicode, sizeof(way->entry.unicode) / sizeof(uint16_t));
+
+            entry = &way->entry;
+        }
+    }
+
+    return entry;
+}
+
+#ifdef USE_XKB_CACHE
+#define FNV_OFFSET_BASIS 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static uint64_t fnv_hash(uint64_t hash, const void *data, size_t length) {
+    const uint8_t *bytes = (const uint8_t *) data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/* Hash the rules, model, layout, variant and options the server was configured
+ * with, from the _XKB_RULES_NAMES root window property, together with the core
+ * keyboard mapping.  The core mapping catches keymaps changed by xmodmap or
+ * xkbcomp without touching the property.  Returns 0 if the key is unavailable.
+ */
+static uint64_t get_keymap_cache_key(xcb_connection_t *connection) {
+    uint64_t hash = 0;
+
+    const xcb_setup_t *setup = xcb_get_setup(connection);
+    xcb_screen_t *screen = xcb_setup_roots_iterator(setup).data;
+
+    xcb_intern_atom_cookie_t atom_cookie = xcb_intern_atom(connection, 1, strlen("_XKB_RULES_NAMES"), "_XKB_RULES_NAMES");
+    xcb_get_keyboard_mapping_cookie_t mapping_cookie = xcb_get_keyboard_mapping(connection,
+            setup->min_keycode, setup->max_keycode - setup->min_keycode + 1);
+
+    xcb_intern_atom_reply_t *atom = xcb_intern_atom_reply(connection, atom_cookie, NULL);
+    xcb_get_keyboard_mapping_reply_t *mapping = xcb_get_keyboard_mapping_reply(connection, mapping_cookie, NULL);
+    if (screen != NULL && atom != NULL && atom->atom != XCB_ATOM_NONE && mapping != NULL) {
+        xcb_get_property_cookie_t property_cookie = xcb_get_property(connection, 0, screen->root,
+                atom->atom, XCB_ATOM_STRING, 0, 1024);
+
+        xcb_get_property_reply_t *property = xcb_get_property_reply(connection, property_cookie, NULL);
+        if (property != NULL && property->format == 8) {
+            hash = fnv_hash(FNV_OFFSET_BASIS, xcb_get_property_value(property), xcb_get_property_value_length(property));
+            hash = fnv_hash(hash, &setup->min_keycode, sizeof(setup->min_keycode));
+            hash = fnv_hash(hash, &mapping->keysyms_per_keycode, sizeof(mapping->keysyms_per_keycode));
+            hash = fnv_hash(hash, xcb_get_keyboard_mapping_keysyms(mapping),
+                    xcb_get_keyboard_mapping_keysyms_length(mapping) * sizeof(xcb_keysym_t));
+        } else {
+            logger(LOG_LEVEL_WARN, "%s [%u]: Failed to get the XKB rules names!\n",
+                    __FUNCTION__, __LINE__);
+        }
+
+        free(property);
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Failed to get the keyboard mapping!\n",
+                __FUNCTION__, __LINE__);
+    }
+
+    free(mapping);
+    free(atom);
+
+    return hash;
+}
+
+/* Returns the cache file for the key, creating its directory under
+ * $XDG_CACHE_HOME or ~/.cache as needed.  The result must be freed.
+ */
+static char * get_keymap_cache_path(uint64_t key) {
+    char *path = NULL;
+
+    char base[512];
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    int length = -1;
+    if (cache_home != NULL && cache_home[0] == '/') {
+        length = snprintf(base, sizeof(base), "%s", cache_home);
+    } else if (home != NULL && home[0] == '/') {
+        length = snprintf(base, sizeof(base), "%s/.cache", home);
+    }
+
+    if (length > 0 && (size_t) length < sizeof(base) - strlen("/libuiohook")) {
+        mkdir(base, 0700);
+
+        strcat(base, "/libuiohook");
+        if (mkdir(base, 0700) == 0 || errno == EEXIST) {
+            size_t size = strlen(base) + strlen("/keymap-0123456789abcdef.xkb") + 1;
+            path = malloc(size);
+            if (path != NULL) {
+                snprintf(path, size, "%s/keymap-%016llx.xkb", base, (unsigned long long) key);
+            }
+        } else {
+            logger(LOG_LEVEL_WARN, "%s [%u]: Failed to create the keymap cache directory %s! (%#X)\n",
+                    __FUNCTION__, __LINE__, base, errno);
+        }
+    }
+
+    return path;
+}
+
+static struct xkb_keymap * load_cached_keymap(struct xkb_context *context, const char *path) {
+    struct xkb_keymap *keymap = NULL;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *buffer = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (buffer != MAP_FAILED) {
+                keymap = xkb_keymap_new_from_buffer(context, buffer, info.st_size,
+                        XKB_KEYMAP_FORMAT_TEXT_V1, XKB_KEYMAP_COMPILE_NO_FLAGS);
+                munmap(buffer, info.st_size);
+            }
+        }
+
+        if (keymap == NULL) {
+            logger(LOG_LEVEL_WARN, "%s [%u]: Ignoring invalid keymap cache %s!\n",
+                    __FUNCTION__, __LINE__, path);
+        }
+
+        close(fd);
+    }
+
+    return keymap;
+}
+
+static void save_cached_keymap(struct xkb_keymap *keymap, const char *path) {
+    char *buffer = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    if (buffer != NULL) {
+        // Write a private file and rename it so readers never see a partial keymap.
+        size_t size = strlen(path) + 16;
+        char *temp = malloc(size);
+        if (temp != NULL) {
+            snprintf(temp, size, "%s.%d", path, (int) getpid());
+
+            bool success = false;
+            FILE *file = fopen(temp, "w");
+            if (file != NULL) {
+                size_t length = strlen(buffer);
+                success = fwrite(buffer, 1, length, file) == length;
+                success = fclose(file) == 0 && success;
+            }
+
+            if (success && rename(temp, path) == 0) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Saved keymap cache %s.\n",
+                        __FUNCTION__, __LINE__, path);
+            } else {
+                logger(LOG_LEVEL_WARN, "%s [%u]: Failed to save keymap cache %s! (%#X)\n",
+                        __FUNCTION__, __LINE__, path, errno);
+                unlink(temp);
+            }
+
+            free(temp);
+        }
+
+        free(buffer);
+    }
+}
+#endif
+
 struct xkb_state * create_xkb_state(struct xkb_context *context, xcb_connection_t *connection) {
     struct xkb_keymap *keymap = NULL;
     struct xkb_state *state = NULL;
 
+    // Entries from a previous keymap no longer apply.
+    flush_keysym_cache();
+
     int32_t device_id = xkb_x11_get_core_keyboard_device_id(connection);
     if (device_id >= 0) {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        #ifdef USE_XKB_CACHE
+        char *path = NULL;
+        uint64_t key = get_keymap_cache_key(connection);
+        if (key != 0) {
+            path = get_keymap_cache_path(key);
+        }
+
+        const char *source = "keymap cache";
+        if (path != NULL) {
+            keymap = load_cached_keymap(context, path);
+        }
+
+        if (keymap == NULL) {
+            source = "server";
+            keymap = xkb_x11_keymap_new_from_device(context, connection, device_id, XKB_KEYMAP_COMPILE_NO_FLAGS);
+            if (keymap != NULL && path != NULL) {
+                save_cached_keymap(keymap, path);
+            }
+        }
+
+        free(path);
+        #else
+        const char *source = "server";
         keymap = xkb_x11_keymap_new_from_device(context, connection, device_id, XKB_KEYMAP_COMPILE_NO_FLAGS);
+        #endif
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Keymap loaded from the %s in %ld us.\n",
+                __FUNCTION__, __LINE__, source,
+                (long) ((end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000L));
+
         state = xkb_x11_state_new_from_device(keymap, connection, device_id);
     }
     #ifdef USE_XKB_FILE
@@ -1657,11 +1919,13 @@ struct xkb_state * create_xkb_state(struct xkb_context *context, xcb_connection_
     }
     #endif
 
+    // The state holds its own keymap reference and is returned with a single reference.
     xkb_map_unref(keymap);
-    return xkb_state_ref(state);
+    return state;
 }
 
 void destroy_xkb_state(struct xkb_state* state) {
+    flush_keysym_cache();
     xkb_state_unref(state);
 }
 
@@ -1687,17 +1951,37 @@ size_t keycode_to_unicode(struct xkb_state* state, KeyCode keycode, uint16_t *bu
     return count;
 }
 #else
-// Faster more flexible alternative to XKeycodeToKeysym...
-KeySym keycode_to_keysym(KeyCode keycode, unsigned int modifier_mask) {
-    KeySym keysym = NoSymbol;
+/* Cached key symbols and characters, built from a keyboard map by
+ * load_input_helper().  Entries are indexed by key code, group and shift
+ * level.  The level for each key type is resolved ahead of time for every
+ * combination of the eight core modifiers, so a lookup is three loads.  The
+ * cache keeps the map it was built from so a lookup never pairs it with a
+ * newer map.
+ */
+typedef struct _keysym_key {
+    uint8_t group[XkbNumKbdGroups];     // Group used for each effective group.
+    uint8_t type[XkbNumKbdGroups];      // Key type index for each group.
+} keysym_key;
+
+struct _keysym_cache {
+    XkbDescPtr map;
+    keysym_key keys[KEY_DESCRIPTOR_COUNT];
+    uint8_t (*levels)[256];             // Shift level by key type and core modifiers.
+    keysym_entry *entries;
+    unsigned int num_groups;
+    unsigned int num_levels;
+};
+
+static struct _keysym_cache *keysym_cache = NULL;
+
+static const keysym_entry empty_keysym_entry = { NoSymbol, { 0x0000, 0x0000 }, 0 };
 
-    if (keyboard_map != NULL) {
-        // Get the range and number of symbols groups bound to the key.
-        unsigned char info = XkbKeyGroupInfo(keyboard_map, keycode);
-        unsigned int num_groups = XkbKeyNumGroups(keyboard_map, keycode);
+// Resolve the group a key uses for an effective group, per its out of range action.
+static unsigned int resolve_key_group(XkbDescPtr map, KeyCode keycode, unsigned int group) {
+    unsigned char info = XkbKeyGroupInfo(map, keycode);
+    unsigned int num_groups = XkbKeyNumGroups(map, keycode);
 
-        // Get the group.
-        unsigned int group = 0x0000;
+    if (group >= num_groups) {
         switch (XkbOutOfRangeGroupAction(info)) {
             case XkbRedirectIntoRange:
                 /* If the RedirectIntoRange flag is set, the four least significant
@@ -1705,7 +1989,7 @@ KeySym keycode_to_keysym(KeyCode keycode, unsigned int modifier_mask) {
                  * which all illegal groups correspond. If the specified group is
                  * also out of range, all illegal groups map to Group1.
                  */
-                group = XkbOutOfRangeGroupInfo(info);
+                group = XkbOutOfRangeGroupNumber(info);
                 if (group >= num_groups) {
                     group = 0;
                 }
@@ -1729,74 +2013,304 @@ KeySym keycode_to_keysym(KeyCode keycode, unsigned int modifier_mask) {
                  * Group3 or Group2 symbols if the global effective group is Group4.
                  */
             default:
-                if (num_groups != 0) {
-                    group %= num_groups;
-                }
+                group %= num_groups;
                 break;
         }
+    }
+
+    return group;
+}
+
+static void free_keysym_cache(struct _keysym_cache *cache) {
+    if (cache != NULL) {
+        if (cache->levels != NULL) {
+            free(cache->levels);
+        }
+
+        if (cache->entries != NULL) {
+            free(cache->entries);
+        }
+
+        free(cache);
+    }
+}
+
+static struct _keysym_cache * build_keysym_cache(XkbDescPtr map) {
+    struct _keysym_cache *cache = calloc(1, sizeof(struct _keysym_cache));
+    if (cache == NULL) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for the key symbol cache!\n",
+                __FUNCTION__, __LINE__);
+
+        return NULL;
+    }
+
+    cache->map = map;
+
+    unsigned int num_types = map->map->num_types;
+    cache->num_groups = 1;
+    cache->num_levels = 1;
+    for (unsigned int i = 0; i < num_types; i++) {
+        if (map->map->types[i].num_levels > cache->num_levels) {
+            cache->num_levels = map->map->types[i].num_levels;
+        }
+    }
 
-        XkbKeyTypePtr key_type = XkbKeyKeyType(keyboard_map, keycode, group);
-        unsigned int active_mods = modifier_mask & key_type->mods.mask;
+    for (unsigned int keycode = map->min_key_code; keycode <= map->max_key_code; keycode++) {
+        if (XkbKeyNumGroups(map, keycode) > cache->num_groups) {
+            cache->num_groups = XkbKeyNumGroups(map, keycode);
+        }
+    }
 
-        int i, level = 0;
-        for (i = 0; i < key_type->map_count; i++) {
-            if (key_type->map[i].active && key_type->map[i].mods.mask == active_mods) {
-                level = key_type->map[i].level;
+    cache->levels = calloc(num_types > 0 ? num_types : 1, sizeof(*cache->levels));
+    cache->entries = calloc(KEY_DESCRIPTOR_COUNT * cache->num_groups * cache->num_levels, sizeof(keysym_entry));
+    if (cache->levels == NULL || cache->entries == NULL) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for the key symbol cache!\n",
+                __FUNCTION__, __LINE__);
+
+        free_keysym_cache(cache);
+        cache = NULL;
+    } else {
+        // The last matching map entry decides the level, level 0 if none match.
+        for (unsigned int i = 0; i < num_types; i++) {
+            XkbKeyTypePtr key_type = &map->map->types[i];
+            for (unsigned int mods = 0; mods < 256; mods++) {
+                unsigned int active_mods = mods & key_type->mods.mask;
+
+                uint8_t level = 0;
+                for (int j = 0; j < key_type->map_count; j++) {
+                    if (key_type->map[j].active && key_type->map[j].mods.mask == active_mods) {
+                        level = key_type->map[j].level;
+                    }
+                }
+
+                cache->levels[i][mods] = level;
             }
         }
 
-        keysym = XkbKeySymEntry(keyboard_map, keycode, level, group);
+        for (unsigned int keycode = map->min_key_code; keycode <= map->max_key_code; keycode++) {
+            unsigned int num_groups = XkbKeyNumGroups(map, keycode);
+            if (num_groups > 0) {
+                keysym_key *key = &cache->keys[keycode];
+                for (unsigned int group = 0; group < XkbNumKbdGroups; group++) {
+                    key->group[group] = resolve_key_group(map, keycode, group);
+                    key->type[group] = XkbKeyKeyTypeIndex(map, keycode, key->group[group]);
+                }
+
+                for (unsigned int group = 0; group < num_groups; group++) {
+                    XkbKeyTypePtr key_type = XkbKeyKeyType(map, keycode, group);
+                    for (unsigned int level = 0; level < key_type->num_levels; level++) {
+                        keysym_entry *entry = &cache->entries[(keycode * cache->num_groups + group) * cache->num_levels + level];
+                        entry->keysym = XkbKeySymEntry(map, keycode, level, group);
+                        entry->count = keysym_to_unicode(entry->keysym, entry->unicode, sizeof(entry->unicode) / sizeof(uint16_t));
+                    }
+                }
+            }
+        }
+    }
+
+    return cache;
+}
+
+const keysym_entry * keycode_to_keysym_entry(KeyCode keycode, unsigned int modifier_mask) {
+    const keysym_entry *entry = &empty_keysym_entry;
+
+    const struct _keysym_cache *cache = __atomic_load_n(&keysym_cache, __ATOMIC_ACQUIRE);
+    if (cache != NULL && keycode >= cache->map->min_key_code && keycode <= cache->map->max_key_code
+            && XkbKeyNumGroups(cache->map, keycode) > 0) {
+        const keysym_key *key = &cache->keys[keycode];
+        unsigned int group = key->group[XkbGroupForCoreState(modifier_mask)];
+        unsigned int level = cache->levels[key->type[XkbGroupForCoreState(modifier_mask)]][modifier_mask & 0xFF];
+
+        entry = &cache->entries[(keycode * cache->num_groups + group) * cache->num_levels + level];
+    }
+
+    return entry;
+}
+
+// Faster more flexible alternative to XKeycodeToKeysym...
+KeySym keycode_to_keysym(KeyCode keycode, unsigned int modifier_mask) {
+    return keycode_to_keysym_entry(keycode, modifier_mask)->keysym;
+}
+#endif
+
+// Check if any symbol bound to the key produces a character.
+static bool is_printable_keycode(KeyCode keycode) {
+    // Without a keyboard map every key is looked up.
+    bool is_printable = true;
+
+    if (keyboard_map != NULL && keycode >= keyboard_map->min_key_code && keycode <= keyboard_map->max_key_code) {
+        is_printable = false;
+
+        uint16_t buffer[2];
+        KeySym *keysyms = XkbKeySymsPtr(keyboard_map, keycode);
+        int count = XkbKeyNumSyms(keyboard_map, keycode);
+        for (int i = 0; i < count && !is_printable; i++) {
+            is_printable = keysym_to_unicode(keysyms[i], buffer, sizeof(buffer) / sizeof(uint16_t)) > 0;
+        }
+    }
+
+    return is_printable;
+}
+
+static void build_key_descriptor(key_descriptor *descriptor, KeyCode keycode, uint16_t scancode) {
+    descriptor->scancode = scancode;
+    descriptor->is_printable = is_printable_keycode(keycode);
+
+    switch (scancode) {
+        case VC_SHIFT_L:   descriptor->modifier = MASK_SHIFT_L; break;
+        case VC_SHIFT_R:   descriptor->modifier = MASK_SHIFT_R; break;
+        case VC_CONTROL_L: descriptor->modifier = MASK_CTRL_L;  break;
+        case VC_CONTROL_R: descriptor->modifier = MASK_CTRL_R;  break;
+        case VC_ALT_L:     descriptor->modifier = MASK_ALT_L;   break;
+        case VC_ALT_R:     descriptor->modifier = MASK_ALT_R;   break;
+        case VC_META_L:    descriptor->modifier = MASK_META_L;  break;
+        case VC_META_R:    descriptor->modifier = MASK_META_R;  break;
+        default:           descriptor->modifier = 0x0000;       break;
+    }
+
+    switch (scancode) {
+        case VC_KP_SEPARATOR:
+        case VC_KP_1:
+        case VC_KP_2:
+        case VC_KP_3:
+        case VC_KP_4:
+        case VC_KP_5:
+        case VC_KP_6:
+        case VC_KP_7:
+        case VC_KP_8:
+        case VC_KP_0:
+        case VC_KP_9:
+            descriptor->is_keypad = true;
+            break;
+
+        default:
+            descriptor->is_keypad = false;
+            break;
+    }
+}
+
+// Precompute everything the hook needs to know about each key code.
+static void build_key_descriptors() {
+    for (unsigned int keycode = 0; keycode < KEY_DESCRIPTOR_COUNT; keycode++) {
+        build_key_descriptor(&key_descriptors[keycode], (KeyCode) keycode, keycode_to_scancode((KeyCode) keycode));
     }
 
-    return keysym;
+    #ifdef USE_EVDEV
+    // Evdev codes offset by 8, regardless of the key codes used by the X server.
+    unsigned short evdev_size = sizeof(evdev_scancode_table) / sizeof(evdev_scancode_table[0]);
+    for (unsigned int keycode = 0; keycode < KEY_DESCRIPTOR_COUNT; keycode++) {
+        uint16_t scancode = keycode < evdev_size ? evdev_scancode_table[keycode][0] : VC_UNDEFINED;
+        build_key_descriptor(&evdev_key_descriptors[keycode], (KeyCode) keycode, scancode);
+    }
+    #endif
+}
+
+const key_descriptor * get_key_descriptors() {
+    return key_descriptors;
+}
+
+#ifdef USE_EVDEV
+const key_descriptor * get_evdev_key_descriptors() {
+    return evdev_key_descriptors;
 }
 #endif
 
 void load_input_helper(Display *disp) {
-    /* The following code block is based on vncdisplaykeymap.c under the terms:
-     *
-     * Copyright (C) 2008  Anthony Liguori <anthony codemonkey ws>
-     *
-     * This program is free software; you can redistribute it and/or modify
-     * it under the terms of the GNU Lesser General Public License version 2 as
-     * published by the Free Software Foundation.
-     */
-    XkbDescPtr desc = XkbGetKeyboard(disp, XkbGBN_AllComponentsMask, XkbUseCoreKbd);
-    if (desc != NULL && desc->names != NULL) {
-        const char *layout_name = XGetAtomName(disp, desc->names->keycodes);
-        logger(LOG_LEVEL_INFO, "%s [%u]: Found keycode atom '%s' (%i)!\n",
-                __FUNCTION__, __LINE__, layout_name, (unsigned int) desc->names->keycodes);
-
-        const char *prefix_xfree86 = "xfree86_";
+    if (disp != NULL) {
         #ifdef USE_EVDEV
-        const char *prefix_evdev = "evdev_";
-        if (strncmp(layout_name, prefix_evdev, strlen(prefix_evdev)) == 0) {
-            is_evdev = true;
-        } else
+        bool evdev = false;
         #endif
-        if (strncmp(layout_name, prefix_xfree86, strlen(prefix_xfree86)) != 0) {
-            logger(LOG_LEVEL_ERROR, "%s [%u]: Unknown keycode name '%s', please file a bug report!\n",
-                    __FUNCTION__, __LINE__, layout_name);
-        } else if (layout_name == NULL) {
-            logger(LOG_LEVEL_ERROR, "%s [%u]: X atom name failure for desc->names->keycodes!\n",
+
+        /* The following code block is based on vncdisplaykeymap.c under the terms:
+         *
+         * Copyright (C) 2008  Anthony Liguori <anthony codemonkey ws>
+         *
+         * This program is free software; you can redistribute it and/or modify
+         * it under the terms of the GNU Lesser General Public License version 2 as
+         * published by the Free Software Foundation.
+         */
+        XkbDescPtr desc = XkbGetKeyboard(disp, XkbGBN_AllComponentsMask, XkbUseCoreKbd);
+        if (desc != NULL && desc->names != NULL) {
+            const char *layout_name = XGetAtomName(disp, desc->names->keycodes);
+            logger(LOG_LEVEL_INFO, "%s [%u]: Found keycode atom '%s' (%i)!\n",
+                    __FUNCTION__, __LINE__, layout_name, (unsigned int) desc->names->keycodes);
+
+            const char *prefix_xfree86 = "xfree86_";
+            #ifdef USE_EVDEV
+            const char *prefix_evdev = "evdev_";
+            if (strncmp(layout_name, prefix_evdev, strlen(prefix_evdev)) == 0) {
+                evdev = true;
+            } else
+            #endif
+            if (strncmp(layout_name, prefix_xfree86, strlen(prefix_xfree86)) != 0) {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: Unknown keycode name '%s', please file a bug report!\n",
+                        __FUNCTION__, __LINE__, layout_name);
+            } else if (layout_name == NULL) {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: X atom name failure for desc->names->keycodes!\n",
+                        __FUNCTION__, __LINE__);
+            }
+
+            XkbFreeClientMap(desc, XkbGBN_AllComponentsMask, True);
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: XkbGetKeyboard failed to locate a valid keyboard!\n",
                     __FUNCTION__, __LINE__);
         }
 
-        XkbFreeClientMap(desc, XkbGBN_AllComponentsMask, True);
+        // Get the map.
+        XkbDescPtr map = XkbGetMap(disp, XkbAllClientInfoMask, XkbUseCoreKbd);
+
+        #ifndef USE_XKB_COMMON
+        struct _keysym_cache *cache = NULL;
+        if (map != NULL) {
+            cache = build_keysym_cache(map);
+        }
+        #endif
+
+        /* Publish the new tables before freeing the old ones.  The posting
+         * thread and hook_post_event() callers translate key codes with
+         * is_evdev at any time, so it goes straight from the old value to the
+         * new one.  The map and the key symbol cache are only read by the hook
+         * thread, which is also the thread reloading them.
+         */
+        #ifdef USE_EVDEV
+        __atomic_store_n(&is_evdev, evdev, __ATOMIC_RELEASE);
+        #endif
+        XkbDescPtr old_map = __atomic_exchange_n(&keyboard_map, map, __ATOMIC_ACQ_REL);
+        #ifndef USE_XKB_COMMON
+        struct _keysym_cache *old_cache = __atomic_exchange_n(&keysym_cache, cache, __ATOMIC_ACQ_REL);
+        #endif
+
+        build_key_descriptors();
+
+        #ifndef USE_XKB_COMMON
+        free_keysym_cache(old_cache);
+        #endif
+        if (old_map != NULL) {
+            XkbFreeClientMap(old_map, XkbAllClientInfoMask, true);
+        }
     } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: XkbGetKeyboard failed to locate a valid keyboard!\n",
-                __FUNCTION__, __LINE__);
+        // Without a display only the evdev key codes are known.
+        build_key_descriptors();
     }
+}
+
+void reload_input_helper(Display *disp) {
+    load_input_helper(disp);
 
-    // Get the map.
-    keyboard_map = XkbGetMap(disp, XkbAllClientInfoMask, XkbUseCoreKbd);
+    logger(LOG_LEVEL_DEBUG, "%s [%u]: Reloaded the keyboard map.\n",
+            __FUNCTION__, __LINE__);
 }
 
 void unload_input_helper() {
-    if (keyboard_map) {
-        XkbFreeClientMap(keyboard_map, XkbAllClientInfoMask, true);
+    #ifndef USE_XKB_COMMON
+    free_keysym_cache(__atomic_exchange_n(&keysym_cache, NULL, __ATOMIC_ACQ_REL));
+    #endif
+
+    XkbDescPtr map = __atomic_exchange_n(&keyboard_map, NULL, __ATOMIC_ACQ_REL);
+    if (map != NULL) {
+        XkbFreeClientMap(map, XkbAllClientInfoMask, true);
         #ifdef USE_EVDEV
-        is_evdev = false;
+        __atomic_store_n(&is_evdev, false, __ATOMIC_RELEASE);
         #endif
     }
 }
@@ -19,6 +19,7 @@
 #ifndef _included_input_helper
 #define _included_input_helper
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <X11/Xlib.h>
 
@@ -40,6 +41,24 @@
 #define XButton1    8
 #define XButton2    9
 
+// Number of X11 key codes, key codes are a single byte.
+#define KEY_DESCRIPTOR_COUNT 256
+
+// Everything the hook needs to know about a key code, precomputed per keymap.
+typedef struct _key_descriptor {
+    uint16_t scancode;      // Virtual key code reported for the key.
+    uint16_t modifier;      // Modifier mask held while the key is down, or 0x0000.
+    bool is_keypad;         // Keypad key offset by 0xEE00 while num lock is off.
+    bool is_printable;      // Any symbol bound to the key produces a character.
+} key_descriptor;
+
+// Key symbol and characters produced by a key code in one modifier and group state.
+typedef struct _keysym_entry {
+    KeySym keysym;
+    uint16_t unicode[2];
+    uint8_t count;
+} keysym_entry;
+
 /* Converts an X11 key symbol to a single Unicode character.  No direct X11
  * functionality exists to provide this information.
  */
@@ -58,6 +77,18 @@ extern uint16_t keycode_to_scancode(KeyCode keycode);
  */
 extern KeyCode scancode_to_keycode(uint16_t scancode);
 
+/* Returns the key descriptor table indexed by X11 key code.  The table is built
+ * by load_input_helper() and holds KEY_DESCRIPTOR_COUNT entries.
+ */
+extern const key_descriptor * get_key_descriptors();
+
+#ifdef USE_EVDEV
+/* Returns the key descriptor table indexed by Linux input event key code + 8,
+ * regardless of the key codes used by the X server.
+ */
+extern const key_descriptor * get_evdev_key_descriptors();
+#endif
+
 
 #ifdef USE_XKB_COMMON
 
@@ -66,6 +97,12 @@ extern KeyCode scancode_to_keycode(uint16_t scancode);
  */
 extern size_t keycode_to_unicode(struct xkb_state* state, KeyCode keycode, uint16_t *buffer, size_t size);
 
+/* Converts an X11 key code to the key symbol and Unicode characters for the
+ * current modifiers and layout of the state.  Results are memoized per key code
+ * until create_xkb_state() or destroy_xkb_state() is called.
+ */
+extern const keysym_entry * keycode_to_keysym_entry(struct xkb_state* state, KeyCode keycode);
+
 /* Create a xkb_state structure and return a pointer to it.
  */
 extern struct xkb_state * create_xkb_state(struct xkb_context *context, xcb_connection_t *connection);
@@ -76,6 +113,12 @@ extern void destroy_xkb_state(struct xkb_state* state);
 
 #else
 
+/* Converts an X11 key code and event mask to the cached key symbol and its
+ * Unicode characters.  The cache is built by load_input_helper() and the
+ * returned entry is valid until the input helper is unloaded.
+ */
+extern const keysym_entry * keycode_to_keysym_entry(KeyCode keycode, unsigned int modifier_mask);
+
 /* Converts an X11 key code and event mask to the appropriate X11 key symbol.
  * This functions in much the same way as XKeycodeToKeysym() but allows for a
  * faster and more flexible lookup.
@@ -85,16 +128,20 @@ extern KeySym keycode_to_keysym(KeyCode keycode, unsigned int modifier_mask);
 #endif
 
 /* Initialize items required for KeyCodeToKeySym() and KeySymToUnicode()
- * functionality.  This method is called by OnLibraryLoad() and may need to be
- * called in combination with UnloadInputHelper() if the native keyboard layout
- * is changed.
+ * functionality.  This method is called by OnLibraryLoad().
  */
 extern void load_input_helper();
 
+/* Rebuild the keyboard map, key symbol cache and key descriptors after the
+ * native keyboard layout changed.  The hook calls this from its own thread
+ * when the settings thread reports a new keyboard mapping.  The new tables are
+ * built before they replace the old ones, which are freed last, so key code
+ * translation on the posting threads never sees a missing map.
+ */
+extern void reload_input_helper(Display *disp);
+
 /* De-initialize items required for KeyCodeToKeySym() and KeySymToUnicode()
- * functionality.  This method is called by OnLibraryUnload() and may need to be
- * called in combination with LoadInputHelper() if the native keyboard layout
- * is changed.
+ * functionality.  This method is called by OnLibraryUnload().
  */
 extern void unload_input_helper();
 
@@ -16,15 +16,29 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
-
-#ifdef USE_XRECORD_ASYNC
 #include <pthread.h>
-#endif
-
+#include <sched.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <uiohook.h>
+#ifdef USE_XRECORD_ASYNC
+#include <poll.h>
+#include <unistd.h>
+#endif
+#ifdef USE_EVDEV
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
 
 #include <xcb/xkb.h>
 #include <X11/XKBlib.h>
@@ -33,6 +47,12 @@
 #include <X11/Xlibint.h>
 #include <X11/Xlib.h>
 #include <X11/extensions/record.h>
+#ifdef USE_XCB_RECORD
+#include <xcb/record.h>
+#endif
+#ifdef USE_XINPUT2
+#include <X11/extensions/XInput2.h>
+#endif
 
 #if defined(USE_XINERAMA) && !defined(USE_XRANDR)
 #include <X11/extensions/Xinerama.h>
@@ -47,18 +67,89 @@
 #include "logger.h"
 #include "input_helper.h"
 
+#if defined(USE_XINERAMA) || defined(USE_XRANDR)
+// Cached screen origin provided by system_properties.c.
+extern bool get_screen_origin(int16_t *x, int16_t *y);
+#endif
+
+#ifndef USE_XKB_COMMON
+// Last indicator state reported to the settings thread in system_properties.c.
+extern unsigned long get_indicator_state(unsigned int *led_mask, Time *time);
+#endif
+
+// Core pointer button mapping cached by the settings thread in system_properties.c.
+extern unsigned long get_button_map(unsigned char *map, int size, int *count);
+extern unsigned long get_button_map_serial();
+
+// Keyboard mapping serial bumped by the settings thread in system_properties.c.
+extern unsigned long get_keyboard_map_serial();
+
 // Thread and hook handles.
 #ifdef USE_XRECORD_ASYNC
 static bool running;
 
-static pthread_cond_t hook_xrecord_cond = PTHREAD_COND_INITIALIZER;
+// Write end of the pipe that wakes xrecord_block() when hook_stop() is called.
+static int hook_wakeup_fd = -1;
 static pthread_mutex_t hook_xrecord_mutex = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+// Set while the application drives the hook started by hook_start_nonblocking().
+static bool nonblocking = false;
+
+// Set while hook_process_pending() or hook_stop() is reading the data display, a
+// hook_stop() from a dispatcher called in that window only sets stop_requested.
+static bool processing_pending = false;
+static bool stop_requested = false;
+
+#ifdef USE_XINPUT2
+// XInput2 raw event backend state, raw events carry no pointer position or
+// modifier state so both are tracked here.  xinput_window is only set while
+// xinput_block() is running and is guarded by hook_control_mutex.
+static int xinput_opcode;
+static int xinput_xkb_event;
+static Window xinput_window = None;
+static Atom xinput_stop_atom = None;
+static int xinput_x, xinput_y;
+static unsigned int xinput_mods, xinput_group;
+static Time xinput_time;
+
+// Raw motion waiting for the XI_Motion event that carries its root position.
+static bool xinput_motion_pending = false;
+static double xinput_motion_x, xinput_motion_y;
+static Time xinput_motion_time;
+#endif
+
+#ifdef USE_EVDEV
+// Older kernel headers do not provide the y2038 safe accessors.
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+// Linux evdev backend state, evdev has no pointer position so it is tracked
+// here.  evdev_wakeup_fd is only set while evdev_block() is running and is
+// guarded by hook_control_mutex.
+#define EVDEV_MAX_DEVICES 32
+#define EVDEV_READ_SIZE 64
+static struct _evdev_device {
+    int fd;
+    bool owned;
+    struct input_absinfo abs_x, abs_y;
+    size_t pending;
+    unsigned char buffer[sizeof(struct input_event) * EVDEV_READ_SIZE];
+} evdev_devices[EVDEV_MAX_DEVICES];
+static size_t evdev_device_count = 0;
+static int evdev_wakeup_fd = -1;
+static int32_t evdev_x, evdev_y, evdev_width, evdev_height;
+static int32_t evdev_delta_x, evdev_delta_y;
+static bool evdev_moved;
+#endif
+
 typedef struct _hook_info {
     struct _data {
         Display *display;
         XRecordRange *range;
+        bool enabled;
     } data;
     struct _ctrl {
         Display *display;
@@ -70,8 +161,16 @@ typedef struct _hook_info {
         struct xkb_context *context;
         #endif
         uint16_t mask;
+        #ifndef USE_XKB_COMMON
+        struct _locks {
+            unsigned long serial;
+            Time time;
+        } locks;
+        #endif
         struct _mouse {
             bool is_dragged;
+            int16_t delta_x;
+            int16_t delta_y;
             struct _click {
                 unsigned short int count;
                 long int time;
@@ -82,6 +181,12 @@ typedef struct _hook_info {
 } hook_info;
 static hook_info *hook;
 
+// Guards hook and its XRecord context against update_record_range() on other threads.
+static pthread_mutex_t hook_control_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Narrow or widen the recorded range when the event consumers change.
+static void update_record_range();
+
 // For this struct, refer to libxnee, requires Xlibint.h
 typedef union {
     unsigned char       type;
@@ -94,11 +199,33 @@ typedef union {
 
 #if defined(USE_XKB_COMMON)
 static struct xkb_state *state = NULL;
+
+// LED indexes for the current xkb_state keymap.
+static xkb_led_index_t led_caps, led_num, led_scroll;
 #endif
 
 // Virtual event pointer.
 static uiohook_event event;
 
+// Key descriptors for the key codes delivered by the running backend.
+static const key_descriptor *key_descriptors = NULL;
+
+// Keyboard mapping serial the key descriptors and xkb_state were built for.
+static unsigned long keyboard_map_serial = 0;
+
+// Everything the hook needs to know about a device button, after the pointer mapping.
+#define BUTTON_DESCRIPTOR_COUNT 256
+typedef struct _button_descriptor {
+    unsigned char detail;   // Logical X11 button number.
+    uint16_t button;        // Button reported for the logical button, or MOUSE_NOBUTTON.
+    uint16_t mask;          // Modifier mask held while the button is down, or 0x0000.
+    bool is_wheel;          // Logical button is one of the four wheel directions.
+} button_descriptor;
+
+// Button descriptors indexed by device button, rebuilt when the mapping serial changes.
+static button_descriptor button_descriptors[BUTTON_DESCRIPTOR_COUNT];
+static unsigned long button_descriptor_serial = 0;
+
 // Event dispatch callback.
 static dispatcher_t dispatcher = NULL;
 static void* dispatcher_capture = NULL;
@@ -109,898 +236,2792 @@ UIOHOOK_API void hook_set_dispatch_proc(dispatcher_t dispatch_proc, void* captur
 
     dispatcher = dispatch_proc;
     dispatcher_capture = capture;
+
+    update_record_range();
 }
 
-// Send out an event if a dispatcher was set.
-static inline void dispatch_event(uiohook_event *const event) {
-    if (dispatcher != NULL) {
-        logger(LOG_LEVEL_DEBUG, "%s [%u]: Dispatching event type %u.\n",
-                __FUNCTION__, __LINE__, event->type);
+// Batched event dispatch callback.
+static batch_dispatcher_t batch_dispatcher = NULL;
+static void* batch_dispatcher_capture = NULL;
 
-        dispatcher(event, dispatcher_capture);
-    } else {
-        logger(LOG_LEVEL_WARN, "%s [%u]: No dispatch callback set!\n",
+// Events collected on the hook thread in DISPATCH_MODE_SYNC for the batch
+// dispatcher and for coalescing.
+#define DISPATCH_BATCH_SIZE 64
+static uiohook_event batch_events[DISPATCH_BATCH_SIZE];
+static size_t batch_count = 0;
+
+// Monotonic time in ms when the run held at the end of the batch is due, 0 if none.
+static uint64_t batch_deadline = 0;
+
+UIOHOOK_API void hook_set_batch_dispatch_proc(batch_dispatcher_t dispatch_proc, void* capture) {
+    logger(LOG_LEVEL_DEBUG, "%s [%u]: Setting new batch dispatch callback to %#p.\n",
+            __FUNCTION__, __LINE__, dispatch_proc);
+
+    batch_dispatcher_capture = capture;
+    batch_dispatcher = dispatch_proc;
+
+    update_record_range();
+}
+
+// Asynchronous dispatch settings, see hook_set_dispatch_mode().
+static uint8_t dispatch_mode = DISPATCH_MODE_SYNC;
+static uint32_t dispatch_capacity = 1024;
+
+// Motion and wheel coalescing settings, see hook_set_coalescing().
+static uint8_t coalesce_flags = 0x00;
+static uint32_t coalesce_window = 0;
+static uint32_t coalesce_max = 0;
+
+UIOHOOK_API int hook_set_coalescing(uint8_t flags, uint32_t window_ms, uint32_t max_events) {
+    int status = UIOHOOK_SUCCESS;
+
+    flags &= COALESCE_MOUSE_MOTION | COALESCE_MOUSE_WHEEL;
+
+    #if !defined(USE_XRECORD_ASYNC) && !defined(USE_XCB_RECORD) && !defined(USE_XINPUT2)
+    if (flags != 0x00 && dispatch_mode == DISPATCH_MODE_SYNC) {
+        // hook_event_proc() is called per datum without a way to tell where a burst ends.
+        logger(LOG_LEVEL_WARN, "%s [%u]: Coalescing is not supported with synchronous XRecord in DISPATCH_MODE_SYNC!\n",
                 __FUNCTION__, __LINE__);
+
+        status = UIOHOOK_FAILURE;
     }
-}
+    #endif
 
-// Set the native modifier mask for future events.
-static inline void set_modifier_mask(uint16_t mask) {
-    hook->input.mask |= mask;
-}
+    if (status == UIOHOOK_SUCCESS) {
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Setting coalescing flags to %#X, window %u ms, %u event(s).\n",
+                __FUNCTION__, __LINE__, flags, window_ms, max_events);
 
-// Unset the native modifier mask for future events.
-static inline void unset_modifier_mask(uint16_t mask) {
-    hook->input.mask &= ~mask;
-}
+        coalesce_window = window_ms;
+        coalesce_max = max_events;
+        coalesce_flags = flags;
+    }
 
-// Get the current native modifier mask state.
-static inline uint16_t get_modifiers() {
-    return hook->input.mask;
+    return status;
 }
 
-// Initialize the modifier lock masks.
-static void initialize_locks() {
-    #ifdef USE_XKB_COMMON
-    if (xkb_state_led_name_is_active(state, XKB_LED_NAME_CAPS)) {
-        set_modifier_mask(MASK_CAPS_LOCK);
-    } else {
-        unset_modifier_mask(MASK_CAPS_LOCK);
+// Check if next can be folded into prev without changing what a consumer observes.
+static inline bool can_coalesce(uint8_t flags, uiohook_event *const prev, uiohook_event *const next) {
+    bool status = false;
+
+    if (prev->type == next->type && prev->mask == next->mask) {
+        if (next->type == EVENT_MOUSE_MOVED || next->type == EVENT_MOUSE_DRAGGED) {
+            status = (flags & COALESCE_MOUSE_MOTION) != 0;
+        } else if (next->type == EVENT_MOUSE_WHEEL) {
+            status = (flags & COALESCE_MOUSE_WHEEL) != 0
+                    && prev->data.wheel.type == next->data.wheel.type
+                    && prev->data.wheel.amount == next->data.wheel.amount
+                    && prev->data.wheel.direction == next->data.wheel.direction
+                    && (prev->data.wheel.rotation < 0) == (next->data.wheel.rotation < 0);
+        }
     }
 
-    if (xkb_state_led_name_is_active(state, XKB_LED_NAME_NUM)) {
-        set_modifier_mask(MASK_NUM_LOCK);
-    } else {
-        unset_modifier_mask(MASK_NUM_LOCK);
-    }
+    return status;
+}
 
-    if (xkb_state_led_name_is_active(state, XKB_LED_NAME_SCROLL)) {
-        set_modifier_mask(MASK_SCROLL_LOCK);
-    } else {
-        unset_modifier_mask(MASK_SCROLL_LOCK);
+/* Collapse runs of consecutive motion events into the latest position and runs
+ * of same direction wheel events into one event with the summed rotation.  The
+ * events are compacted in place and the new count is returned.  Any other event
+ * ends the current run, so the relative order of everything else is unchanged.
+ * Only events that are already queued together are merged, nothing is delayed.
+ */
+static size_t coalesce_events(uiohook_event *const events, size_t count) {
+    uint8_t flags = coalesce_flags;
+    uint32_t window = coalesce_window;
+    uint32_t max = coalesce_max;
+
+    if (flags == 0x00 || count < 2) {
+        return count;
     }
-    #else
-    unsigned int led_mask = 0x00;
-    if (XkbGetIndicatorState(hook->ctrl.display, XkbUseCoreKbd, &led_mask) == Success) {
-        if (led_mask & 0x01) {
-            set_modifier_mask(MASK_CAPS_LOCK);
-        } else {
-            unset_modifier_mask(MASK_CAPS_LOCK);
-        }
 
-        if (led_mask & 0x02) {
-            set_modifier_mask(MASK_NUM_LOCK);
+    size_t length = 1;
+    uint64_t first_time = events[0].time;
+    uint32_t merged = 1;
+    for (size_t i = 1; i < count; i++) {
+        uiohook_event *const prev = &events[length - 1];
+        uiohook_event *const next = &events[i];
+
+        if (can_coalesce(flags, prev, next)
+                && (window == 0 || next->time - first_time <= window)
+                && (max == 0 || merged < max)) {
+            if (next->type == EVENT_MOUSE_WHEEL) {
+                int32_t rotation = prev->data.wheel.rotation + next->data.wheel.rotation;
+                if (rotation > INT16_MAX) {
+                    rotation = INT16_MAX;
+                } else if (rotation < INT16_MIN) {
+                    rotation = INT16_MIN;
+                }
+
+                *prev = *next;
+                prev->data.wheel.rotation = (int16_t) rotation;
+            } else {
+                *prev = *next;
+            }
+
+            merged++;
         } else {
-            unset_modifier_mask(MASK_NUM_LOCK);
+            if (length != i) {
+                events[length] = *next;
+            }
+
+            first_time = next->time;
+            merged = 1;
+            length++;
         }
+    }
 
-        if (led_mask & 0x04) {
-            set_modifier_mask(MASK_SCROLL_LOCK);
+    return length;
+}
+
+/* Subscribers added with hook_add_dispatch_proc().  The list is an immutable
+ * snapshot that is replaced as a whole under subscribers_mutex, so the dispatch
+ * path only needs an atomic load.  Events are only dispatched from one thread
+ * at a time, either the hook thread or the dispatch thread, and that thread
+ * makes reader_seq odd while it uses a snapshot.  A replaced snapshot is
+ * retired with the reader_seq value seen after it was unpublished and freed
+ * once the reader has left that dispatch.
+ */
+typedef struct _subscriber {
+    dispatcher_t proc;
+    void *capture;
+    uint32_t mask;
+} subscriber;
+
+typedef struct _subscriber_list {
+    uint32_t mask;
+    size_t count;
+    struct _subscriber_list *next;
+    unsigned long retired_seq;
+    subscriber entries[];
+} subscriber_list;
+
+static subscriber_list *subscribers = NULL;
+static subscriber_list *retired_subscribers = NULL;
+static unsigned long reader_seq = 0;
+static pthread_mutex_t subscribers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Free retired snapshots that the dispatching thread can no longer see.
+static void reclaim_subscribers() {
+    unsigned long seq = __atomic_load_n(&reader_seq, __ATOMIC_SEQ_CST);
+
+    subscriber_list **prev = &retired_subscribers;
+    while (*prev != NULL) {
+        subscriber_list *list = *prev;
+        if ((list->retired_seq & 1) == 0 || list->retired_seq != seq) {
+            *prev = list->next;
+            free(list);
         } else {
-            unset_modifier_mask(MASK_SCROLL_LOCK);
+            prev = &list->next;
         }
-    } else {
-        logger(LOG_LEVEL_WARN, "%s [%u]: XkbGetIndicatorState failed to get current led mask!\n",
-                __FUNCTION__, __LINE__);
     }
-    #endif
 }
 
-// Initialize the modifier mask to the current modifiers.
-static void initialize_modifiers() {
-    hook->input.mask = 0x0000;
-
-    KeyCode keycode;
-    char keymap[32];
-    XQueryKeymap(hook->ctrl.display, keymap);
+// Publish a new snapshot and retire the old one, subscribers_mutex must be held.
+static void publish_subscribers(subscriber_list *list) {
+    subscriber_list *old = __atomic_exchange_n(&subscribers, list, __ATOMIC_SEQ_CST);
 
-      Window unused_win;
-    int unused_int;
-    unsigned int mask;
-    if (XQueryPointer(hook->ctrl.display, DefaultRootWindow(hook->ctrl.display), &unused_win, &unused_win, &unused_int, &unused_int, &unused_int, &unused_int, &mask)) {
-        if (mask & ShiftMask) {
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_L);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_L); }
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_R);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_R); }
-        }
-        if (mask & ControlMask) {
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_L);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_L);  }
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_R);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_R);  }
-        }
-        if (mask & Mod1Mask) {
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_L);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_L);   }
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_R);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_R);   }
-        }
-        if (mask & Mod4Mask) {
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_L);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_L);  }
-            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_R);
-            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_R);  }
-        }
+    if (old != NULL) {
+        old->retired_seq = __atomic_load_n(&reader_seq, __ATOMIC_SEQ_CST);
+        old->next = retired_subscribers;
+        retired_subscribers = old;
+    }
 
-        if (mask & Button1Mask) { set_modifier_mask(MASK_BUTTON1); }
-        if (mask & Button2Mask) { set_modifier_mask(MASK_BUTTON2); }
-        if (mask & Button3Mask) { set_modifier_mask(MASK_BUTTON3); }
-        if (mask & Button4Mask) { set_modifier_mask(MASK_BUTTON4); }
-        if (mask & Button5Mask) { set_modifier_mask(MASK_BUTTON5); }
-    } else {
-        logger(LOG_LEVEL_WARN, "%s [%u]: XQueryPointer failed to get current modifiers!\n",
-                __FUNCTION__, __LINE__);
+    reclaim_subscribers();
+}
 
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_L);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_L); }
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_R);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_R); }
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_L);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_L);  }
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_R);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_R);  }
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_L);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_L);   }
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_R);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_R);   }
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_L);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_L);  }
-        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_R);
-        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_R);  }
+// Copy the current snapshot, dropping the entry for proc and capture if present.
+static subscriber_list* copy_subscribers(dispatcher_t proc, void *capture, size_t extra, bool *found) {
+    subscriber_list *old = subscribers;
+    size_t count = old != NULL ? old->count : 0;
+
+    subscriber_list *list = malloc(sizeof(subscriber_list) + sizeof(subscriber) * (count + extra));
+    if (list != NULL) {
+        list->mask = 0;
+        list->count = 0;
+        list->next = NULL;
+        list->retired_seq = 0;
+
+        *found = false;
+        for (size_t i = 0; i < count; i++) {
+            if (old->entries[i].proc == proc && old->entries[i].capture == capture) {
+                *found = true;
+            } else {
+                list->entries[list->count] = old->entries[i];
+                list->mask |= old->entries[i].mask;
+                list->count++;
+            }
+        }
     }
 
-    initialize_locks();
+    return list;
 }
 
-void hook_event_proc(XPointer closeure, XRecordInterceptData *recorded_data) {
-    uint64_t timestamp = (uint64_t) recorded_data->server_time;
+UIOHOOK_API int hook_add_dispatch_proc(dispatcher_t dispatch_proc, void* capture, uint32_t mask) {
+    int status = UIOHOOK_FAILURE;
 
-    if (recorded_data->category == XRecordStartOfData) {
-        // Populate the hook start event.
-        event.time = timestamp;
-        event.reserved = 0x00;
+    if (dispatch_proc != NULL) {
+        pthread_mutex_lock(&subscribers_mutex);
 
-        event.type = EVENT_HOOK_ENABLED;
-        event.mask = 0x00;
+        bool found;
+        subscriber_list *list = copy_subscribers(dispatch_proc, capture, 1, &found);
+        if (list != NULL) {
+            // Adding the same callback and capture again replaces its mask.
+            list->entries[list->count].proc = dispatch_proc;
+            list->entries[list->count].capture = capture;
+            list->entries[list->count].mask = mask;
+            list->mask |= mask;
+            list->count++;
 
-        // Fire the hook start event.
-        dispatch_event(&event);
-    } else if (recorded_data->category == XRecordEndOfData) {
-        // Populate the hook stop event.
-        event.time = timestamp;
-        event.reserved = 0x00;
+            publish_subscribers(list);
+            update_record_range();
 
-        event.type = EVENT_HOOK_DISABLED;
-        event.mask = 0x00;
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Added dispatch callback %#p with mask %#X.\n",
+                    __FUNCTION__, __LINE__, dispatch_proc, mask);
 
-        // Fire the hook stop event.
-        dispatch_event(&event);
-    } else if (recorded_data->category == XRecordFromServer || recorded_data->category == XRecordFromClient) {
-        // Get XRecord data.
-        XRecordDatum *data = (XRecordDatum *) recorded_data->data;
-
-        if (data->type == KeyPress) {
-            // The X11 KeyCode associated with this event.
-            KeyCode keycode = (KeyCode) data->event.u.u.detail;
-            KeySym keysym = 0x00;
-            #if defined(USE_XKB_COMMON)
-            if (state != NULL) {
-                keysym = xkb_state_key_get_one_sym(state, keycode);
-            }
-            #else
-            keysym = keycode_to_keysym(keycode, data->event.u.keyButtonPointer.state);
-            #endif
+            status = UIOHOOK_SUCCESS;
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for dispatch callbacks!\n",
+                    __FUNCTION__, __LINE__);
 
-            // Check to make sure the key is printable.
-            uint16_t buffer[2];
-            size_t count =  0;
-            #ifdef USE_XKB_COMMON
-            if (state != NULL) {
-                count = keycode_to_unicode(state, keycode, buffer, sizeof(buffer) / sizeof(uint16_t));
-            }
-            #else
-            count = keysym_to_unicode(keysym, buffer, sizeof(buffer) / sizeof(uint16_t));
-            #endif
+            status = UIOHOOK_ERROR_OUT_OF_MEMORY;
+        }
 
+        pthread_mutex_unlock(&subscribers_mutex);
+    }
 
-            unsigned short int scancode = keycode_to_scancode(keycode);
+    return status;
+}
 
-            // TODO If you have a better suggestion for this ugly, let me know.
-            if      (scancode == VC_SHIFT_L)   { set_modifier_mask(MASK_SHIFT_L); }
-            else if (scancode == VC_SHIFT_R)   { set_modifier_mask(MASK_SHIFT_R); }
-            else if (scancode == VC_CONTROL_L) { set_modifier_mask(MASK_CTRL_L);  }
-            else if (scancode == VC_CONTROL_R) { set_modifier_mask(MASK_CTRL_R);  }
-            else if (scancode == VC_ALT_L)     { set_modifier_mask(MASK_ALT_L);   }
-            else if (scancode == VC_ALT_R)     { set_modifier_mask(MASK_ALT_R);   }
-            else if (scancode == VC_META_L)    { set_modifier_mask(MASK_META_L);  }
-            else if (scancode == VC_META_R)    { set_modifier_mask(MASK_META_R);  }
-            #ifdef USE_XKB_COMMON
-            xkb_state_update_key(state, keycode, XKB_KEY_DOWN);
-            #endif
-            initialize_locks();
-
-
-            if ((get_modifiers() & MASK_NUM_LOCK) == 0) {
-                switch (scancode) {
-                    case VC_KP_SEPARATOR:
-                    case VC_KP_1:
-                    case VC_KP_2:
-                    case VC_KP_3:
-                    case VC_KP_4:
-                    case VC_KP_5:
-                    case VC_KP_6:
-                    case VC_KP_7:
-                    case VC_KP_8:
-                    case VC_KP_0:
-                    case VC_KP_9:
-                        scancode |= 0xEE00;
-                        break;
-                }
-            }
+UIOHOOK_API int hook_remove_dispatch_proc(dispatcher_t dispatch_proc, void* capture) {
+    int status = UIOHOOK_FAILURE;
 
-            // Populate key pressed event.
-            event.time = timestamp;
-            event.reserved = 0x00;
+    pthread_mutex_lock(&subscribers_mutex);
 
-            event.type = EVENT_KEY_PRESSED;
-            event.mask = get_modifiers();
+    bool found;
+    subscriber_list *list = copy_subscribers(dispatch_proc, capture, 0, &found);
+    if (list == NULL) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for dispatch callbacks!\n",
+                __FUNCTION__, __LINE__);
 
-            event.data.keyboard.keycode = scancode;
-            event.data.keyboard.rawcode = keysym;
-            event.data.keyboard.keychar = CHAR_UNDEFINED;
+        status = UIOHOOK_ERROR_OUT_OF_MEMORY;
+    } else if (!found) {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Dispatch callback %#p is not registered!\n",
+                __FUNCTION__, __LINE__, dispatch_proc);
 
-            logger(LOG_LEVEL_DEBUG, "%s [%u]: Key %#X pressed. (%#X)\n",
-                    __FUNCTION__, __LINE__, event.data.keyboard.keycode, event.data.keyboard.rawcode);
+        free(list);
+    } else {
+        if (list->count == 0) {
+            free(list);
+            list = NULL;
+        }
 
-            // Fire key pressed event.
-            dispatch_event(&event);
+        publish_subscribers(list);
+        update_record_range();
 
-            // If the pressed event was not consumed...
-            if (event.reserved ^ 0x01) {
-                for (unsigned int i = 0; i < count; i++) {
-                    // Populate key typed event.
-                    event.time = timestamp;
-                    event.reserved = 0x00;
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Removed dispatch callback %#p.\n",
+                __FUNCTION__, __LINE__, dispatch_proc);
 
-                    event.type = EVENT_KEY_TYPED;
-                    event.mask = get_modifiers();
+        status = UIOHOOK_SUCCESS;
+    }
 
-                    event.data.keyboard.keycode = VC_UNDEFINED;
-                    event.data.keyboard.rawcode = keysym;
-                    event.data.keyboard.keychar = buffer[i];
+    pthread_mutex_unlock(&subscribers_mutex);
 
-                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Key %#X typed. (%lc)\n",
-                            __FUNCTION__, __LINE__, event.data.keyboard.keycode, (uint16_t) event.data.keyboard.keychar);
+    return status;
+}
 
-                    // Fire key typed event.
-                    dispatch_event(&event);
-                }
-            }
-        } else if (data->type == KeyRelease) {
-            // The X11 KeyCode associated with this event.
-            KeyCode keycode = (KeyCode) data->event.u.u.detail;
-            KeySym keysym = 0x00;
-            #ifdef USE_XKB_COMMON
-            if (state != NULL) {
-                keysym = xkb_state_key_get_one_sym(state, keycode);
-            }
-            #else
-            keysym = keycode_to_keysym(keycode, data->event.u.keyButtonPointer.state);
-            #endif
+/* Single-producer, single-consumer ring buffer used by DISPATCH_MODE_ASYNC.  The
+ * hook thread is the only writer of tail and the dispatch thread is the only
+ * writer of head, so neither side needs a lock to move events.  The mutex and
+ * condition are only used to park the dispatch thread while the ring is empty.
+ */
+typedef struct _dispatch_ring {
+    uiohook_event *events;
+    uint32_t mask;
+    uint32_t head __attribute__ ((aligned (64)));
+    uint32_t tail __attribute__ ((aligned (64)));
+    uint64_t overflow;
+    bool waiting __attribute__ ((aligned (64)));
+    bool running;
+    bool polling;
+} dispatch_ring;
+
+static dispatch_ring ring = { .events = NULL };
+static pthread_t dispatch_thread_id;
+static pthread_mutex_t dispatch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dispatch_cond = PTHREAD_COND_INITIALIZER;
+
+// Reset the ring to an empty queue backed by events, dispatch_mutex must be held.
+static void reset_ring(uiohook_event *events, uint32_t capacity) {
+    ring.mask = capacity - 1;
+    ring.head = 0;
+    ring.tail = 0;
+    ring.overflow = 0;
+    ring.waiting = false;
+    ring.running = false;
+    __atomic_store_n(&ring.events, events, __ATOMIC_RELEASE);
+}
 
-            // Check to make sure the key is printable.
-            uint16_t buffer[2];
-            #ifdef USE_XKB_COMMON
-            if (state != NULL) {
-                keycode_to_unicode(state, keycode, buffer, sizeof(buffer) / sizeof(uint16_t));
-            }
-            #else
-            keysym_to_unicode(keysym, buffer, sizeof(buffer) / sizeof(uint16_t));
-            #endif
+UIOHOOK_API int hook_set_dispatch_mode(uint8_t mode, uint32_t capacity) {
+    int status = UIOHOOK_FAILURE;
 
-            unsigned short int scancode = keycode_to_scancode(keycode);
-
-            // TODO If you have a better suggestion for this ugly, let me know.
-            if        (scancode == VC_SHIFT_L) { unset_modifier_mask(MASK_SHIFT_L); }
-            else if (scancode == VC_SHIFT_R)   { unset_modifier_mask(MASK_SHIFT_R); }
-            else if (scancode == VC_CONTROL_L) { unset_modifier_mask(MASK_CTRL_L);  }
-            else if (scancode == VC_CONTROL_R) { unset_modifier_mask(MASK_CTRL_R);  }
-            else if (scancode == VC_ALT_L)     { unset_modifier_mask(MASK_ALT_L);   }
-            else if (scancode == VC_ALT_R)     { unset_modifier_mask(MASK_ALT_R);   }
-            else if (scancode == VC_META_L)    { unset_modifier_mask(MASK_META_L);  }
-            else if (scancode == VC_META_R)    { unset_modifier_mask(MASK_META_R);  }
-            #ifdef USE_XKB_COMMON
-            xkb_state_update_key(state, keycode, XKB_KEY_UP);
-            #endif
-            initialize_locks();
-
-            if ((get_modifiers() & MASK_NUM_LOCK) == 0) {
-                switch (scancode) {
-                    case VC_KP_SEPARATOR:
-                    case VC_KP_1:
-                    case VC_KP_2:
-                    case VC_KP_3:
-                    case VC_KP_4:
-                    case VC_KP_5:
-                    case VC_KP_6:
-                    case VC_KP_7:
-                    case VC_KP_8:
-                    case VC_KP_0:
-                    case VC_KP_9:
-                        scancode |= 0xEE00;
-                        break;
-                }
-            }
+    pthread_mutex_lock(&dispatch_mutex);
+    if (ring.running || hook != NULL) {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Dispatch mode cannot change while the hook is running!\n",
+                __FUNCTION__, __LINE__);
+    } else if (ring.polling) {
+        // The poll queue is about to be released, the consumer may still be reading it.
+        logger(LOG_LEVEL_WARN, "%s [%u]: Dispatch mode cannot change while hook_poll_events() is running!\n",
+                __FUNCTION__, __LINE__);
+    } else if (mode == DISPATCH_MODE_SYNC || mode == DISPATCH_MODE_ASYNC || mode == DISPATCH_MODE_POLL) {
+        if (capacity == 0) {
+            capacity = 1024;
+        } else if (capacity > 1 << 24) {
+            capacity = 1 << 24;
+        }
 
-            // Populate key released event.
-            event.time = timestamp;
-            event.reserved = 0x00;
+        // Round the capacity up to a power of two so indexes can be masked.
+        uint32_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
 
-            event.type = EVENT_KEY_RELEASED;
-            event.mask = get_modifiers();
+        // Release the queue kept between runs for DISPATCH_MODE_POLL.
+        uiohook_event *events = ring.events;
+        if (events != NULL) {
+            __atomic_store_n(&ring.events, NULL, __ATOMIC_RELEASE);
+            free(events);
+        }
 
-            event.data.keyboard.keycode = scancode;
-            event.data.keyboard.rawcode = keysym;
-            event.data.keyboard.keychar = CHAR_UNDEFINED;
+        status = UIOHOOK_SUCCESS;
 
-            logger(LOG_LEVEL_DEBUG, "%s [%u]: Key %#X released. (%#X)\n",
-                    __FUNCTION__, __LINE__, event.data.keyboard.keycode, event.data.keyboard.rawcode);
+        // The poll queue exists as long as the mode is set so it can be polled
+        // before, during and after hook_run().
+        if (mode == DISPATCH_MODE_POLL) {
+            events = malloc(sizeof(uiohook_event) * size);
+            if (events != NULL) {
+                reset_ring(events, size);
+            } else {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for dispatch ring!\n",
+                        __FUNCTION__, __LINE__);
 
-            // Fire key released event.
-            dispatch_event(&event);
-        } else if (data->type == ButtonPress) {
-            // X11 handles wheel events as button events.
-            if (data->event.u.u.detail == WheelUp || data->event.u.u.detail == WheelDown
-                    || data->event.u.u.detail == WheelLeft || data->event.u.u.detail == WheelRight) {
+                mode = DISPATCH_MODE_SYNC;
+                status = UIOHOOK_ERROR_OUT_OF_MEMORY;
+            }
+        }
 
-                // Reset the click count and previous button.
-                hook->input.mouse.click.count = 1;
-                hook->input.mouse.click.button = MOUSE_NOBUTTON;
+        dispatch_mode = mode;
+        dispatch_capacity = size;
 
-                /* Scroll wheel release events.
-                 * Scroll type: WHEEL_UNIT_SCROLL
-                 * Scroll amount: 3 unit increments per notch
-                 * Units to scroll: 3 unit increments
-                 * Vertical unit increment: 15 pixels
-                 */
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Dispatch mode set to %u with capacity %u.\n",
+                __FUNCTION__, __LINE__, mode, size);
+    }
+    pthread_mutex_unlock(&dispatch_mutex);
 
-                // Populate mouse wheel event.
-                event.time = timestamp;
-                event.reserved = 0x00;
+    return status;
+}
 
-                event.type = EVENT_MOUSE_WHEEL;
-                event.mask = get_modifiers();
+UIOHOOK_API void hook_get_dispatch_stats(dispatch_stats *stats) {
+    stats->capacity = 0;
+    stats->occupancy = 0;
+    stats->overflow = 0;
 
-                event.data.wheel.clicks = hook->input.mouse.click.count;
-                event.data.wheel.x = data->event.u.keyButtonPointer.rootX;
-                event.data.wheel.y = data->event.u.keyButtonPointer.rootY;
+    pthread_mutex_lock(&dispatch_mutex);
+    if (ring.events != NULL) {
+        uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+        uint32_t tail = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
 
-                #if defined(USE_XINERAMA) || defined(USE_XRANDR)
-                uint8_t count;
-                screen_data *screens = hook_create_screen_info(&count);
-                if (count > 1) {
-                    event.data.wheel.x -= screens[0].x;
-                    event.data.wheel.y -= screens[0].y;
-                }
+        stats->capacity = ring.mask + 1;
+        stats->occupancy = tail - head;
+        stats->overflow = __atomic_load_n(&ring.overflow, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&dispatch_mutex);
+}
 
-                if (screens != NULL) {
-                    free(screens);
-                }
-                #endif
+// Send out a batch of events to the dispatcher and any subscribers whose mask
+// matches, followed by a single call to the batch dispatcher.
+static inline void invoke_dispatcher(uiohook_event *const events, size_t count) {
+    __atomic_add_fetch(&reader_seq, 1, __ATOMIC_SEQ_CST);
+    subscriber_list *list = __atomic_load_n(&subscribers, __ATOMIC_SEQ_CST);
+    batch_dispatcher_t batch_proc = batch_dispatcher;
 
-                /* X11 does not have an API call for acquiring the mouse scroll type.  This
-                 * maybe part of the XInput2 (XI2) extention but I will wont know until it
-                 * is available on my platform.  For the time being we will just use the
-                 * unit scroll value.
-                 */
-                event.data.wheel.type = WHEEL_UNIT_SCROLL;
-
-                /* Some scroll wheel properties are available via the new XInput2 (XI2)
-                 * extension.  Unfortunately the extension is not available on my
-                 * development platform at this time.  For the time being we will just
-                 * use the Windows default value of 3.
-                 */
-                event.data.wheel.amount = 3;
-
-                if (data->event.u.u.detail == WheelUp || data->event.u.u.detail == WheelLeft) {
-                    // Wheel Rotated Up and Away.
-                    event.data.wheel.rotation = -1;
-                } else { // data->event.u.u.detail == WheelDown
-                    // Wheel Rotated Down and Towards.
-                    event.data.wheel.rotation = 1;
-                }
+    if (dispatcher != NULL || list != NULL || batch_proc != NULL) {
+        for (size_t i = 0; i < count; i++) {
+            uiohook_event *const event = &events[i];
 
-                if (data->event.u.u.detail == WheelUp || data->event.u.u.detail == WheelDown) {
-                    // Wheel Rotated Up or Down.
-                    event.data.wheel.direction = WHEEL_VERTICAL_DIRECTION;
-                } else { // data->event.u.u.detail == WheelLeft || data->event.u.u.detail == WheelRight
-                    // Wheel Rotated Left or Right.
-                    event.data.wheel.direction = WHEEL_HORIZONTAL_DIRECTION;
-                }
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Dispatching event type %u.\n",
+                    __FUNCTION__, __LINE__, event->type);
 
-                logger(LOG_LEVEL_DEBUG, "%s [%u]: Mouse wheel type %u, rotated %i units in the %u direction at %u, %u.\n",
-                        __FUNCTION__, __LINE__, event.data.wheel.type,
-                        event.data.wheel.amount * event.data.wheel.rotation,
-                        event.data.wheel.direction,
-                        event.data.wheel.x, event.data.wheel.y);
+            if (dispatcher != NULL) {
+                dispatcher(event, dispatcher_capture);
+            }
 
-                // Fire mouse wheel event.
-                dispatch_event(&event);
-            } else {
-                /* This information is all static for X11, its up to the WM to
-                 * decide how to interpret the wheel events.
-                 */
-                uint16_t button = MOUSE_NOBUTTON;
-                switch (data->event.u.u.detail) {
-                    // FIXME This should use a lookup table to handle button remapping.
-                    case Button1:
-                        button = MOUSE_BUTTON1;
-                        set_modifier_mask(MASK_BUTTON1);
-                        break;
-
-                    case Button2:
-                        button = MOUSE_BUTTON2;
-                        set_modifier_mask(MASK_BUTTON2);
-                        break;
-
-                    case Button3:
-                        button = MOUSE_BUTTON3;
-                        set_modifier_mask(MASK_BUTTON3);
-                        break;
-
-                    case XButton1:
-                        button = MOUSE_BUTTON4;
-                        set_modifier_mask(MASK_BUTTON5);
-                        break;
-
-                    case XButton2:
-                        button = MOUSE_BUTTON5;
-                        set_modifier_mask(MASK_BUTTON5);
-                        break;
-
-                    default:
-                        // Do not set modifier masks past button MASK_BUTTON5.
-                        break;
+            uint32_t type_mask = EVENT_MASK(event->type);
+            if (list != NULL && (list->mask & type_mask)) {
+                for (size_t j = 0; j < list->count; j++) {
+                    if (list->entries[j].mask & type_mask) {
+                        list->entries[j].proc(event, list->entries[j].capture);
+                    }
                 }
+            }
+        }
 
+        if (batch_proc != NULL) {
+            batch_proc(events, count, batch_dispatcher_capture);
+        }
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: No dispatch callback set!\n",
+                __FUNCTION__, __LINE__);
+    }
 
-                // Track the number of clicks, the button must match the previous button.
-                if (button == hook->input.mouse.click.button && (long int) (timestamp - hook->input.mouse.click.time) <= hook_get_multi_click_time()) {
-                    if (hook->input.mouse.click.count < USHRT_MAX) {
-                        hook->input.mouse.click.count++;
-                    } else {
-                        logger(LOG_LEVEL_WARN, "%s [%u]: Click count overflow detected!\n",
-                                __FUNCTION__, __LINE__);
-                    }
-                } else {
-                    // Reset the click count.
-                    hook->input.mouse.click.count = 1;
+    __atomic_add_fetch(&reader_seq, 1, __ATOMIC_SEQ_CST);
+}
 
-                    // Set the previous button.
-                    hook->input.mouse.click.button = button;
-                }
+// Copy an event into the ring, returns false if the ring is full.
+static inline bool ring_push(uiohook_event *const event) {
+    uint32_t tail = ring.tail;
+    uint32_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+    if (tail - head > ring.mask) {
+        return false;
+    }
 
-                // Save this events time to calculate the hook->input.mouse.click.count.
-                hook->input.mouse.click.time = timestamp;
+    ring.events[tail & ring.mask] = *event;
+    __atomic_store_n(&ring.tail, tail + 1, __ATOMIC_RELEASE);
 
+    // Wake the dispatch thread if it is parked.  The fence pairs with the one in
+    // dispatch_thread_proc() so either we see waiting or it sees the new tail.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring.waiting, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&dispatch_mutex);
+        pthread_cond_signal(&dispatch_cond);
+        pthread_mutex_unlock(&dispatch_mutex);
+    }
 
-                // Populate mouse pressed event.
-                event.time = timestamp;
-                event.reserved = 0x00;
+    return true;
+}
 
-                event.type = EVENT_MOUSE_PRESSED;
-                event.mask = get_modifiers();
+// Find the oldest run of contiguous events in the ring, returns the run length.
+// The events stay owned by the consumer until ring_release() is called.
+static inline uint32_t ring_peek(uiohook_event **events) {
+    uint32_t head = ring.head;
+    uint32_t tail = __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
 
-                event.data.mouse.button = button;
-                event.data.mouse.clicks = hook->input.mouse.click.count;
-                event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
-                event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
+    uint32_t count = tail - head;
+    uint32_t contiguous = ring.mask + 1 - (head & ring.mask);
+    if (count > contiguous) {
+        count = contiguous;
+    }
 
-                #if defined(USE_XINERAMA) || defined(USE_XRANDR)
-                uint8_t count;
-                screen_data *screens = hook_create_screen_info(&count);
-                if (count > 1) {
-                    event.data.mouse.x -= screens[0].x;
-                    event.data.mouse.y -= screens[0].y;
-                }
+    *events = &ring.events[head & ring.mask];
 
-                if (screens != NULL) {
-                    free(screens);
-                }
-                #endif
+    return count;
+}
 
-                logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u  pressed %u time(s). (%u, %u)\n",
-                        __FUNCTION__, __LINE__, event.data.mouse.button, event.data.mouse.clicks,
-                        event.data.mouse.x, event.data.mouse.y);
+// Hand count events at the head of the ring back to the producer.
+static inline void ring_release(uint32_t count) {
+    __atomic_store_n(&ring.head, ring.head + count, __ATOMIC_RELEASE);
+}
 
-                // Fire mouse pressed event.
-                dispatch_event(&event);
+static void *dispatch_thread_proc(void *arg) {
+    uiohook_event *events;
+    uint32_t count;
+    bool running = true;
+
+    while (running) {
+        // Dispatch everything queued so far in place, at most two runs per drain.
+        while ((count = ring_peek(&events)) > 0) {
+            invoke_dispatcher(events, coalesce_events(events, count));
+            ring_release(count);
+        }
+
+        pthread_mutex_lock(&dispatch_mutex);
+        __atomic_store_n(&ring.waiting, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) == ring.head) {
+            if (ring.running) {
+                pthread_cond_wait(&dispatch_cond, &dispatch_mutex);
+            } else {
+                // Stopped and fully drained.
+                running = false;
             }
         }
-        else if (data->type == ButtonRelease) {
-            // X11 handles wheel events as button events.
-            if (data->event.u.u.detail != WheelUp && data->event.u.u.detail != WheelDown) {
-                /* This information is all static for X11, its up to the WM to
-                 * decide how to interpret the wheel events.
-                 */
-                uint16_t button = MOUSE_NOBUTTON;
-                switch (data->event.u.u.detail) {
-                    // FIXME This should use a lookup table to handle button remapping.
-                    case Button1:
-                        button = MOUSE_BUTTON1;
-                        unset_modifier_mask(MASK_BUTTON1);
-                        break;
-
-                    case Button2:
-                        button = MOUSE_BUTTON2;
-                        unset_modifier_mask(MASK_BUTTON2);
-                        break;
-
-                    case Button3:
-                        button = MOUSE_BUTTON3;
-                        unset_modifier_mask(MASK_BUTTON3);
-                        break;
-
-                    case XButton1:
-                        button = MOUSE_BUTTON4;
-                        unset_modifier_mask(MASK_BUTTON5);
-                        break;
-
-                    case XButton2:
-                        button = MOUSE_BUTTON5;
-                        unset_modifier_mask(MASK_BUTTON5);
-                        break;
-
-                    default:
-                        // Do not set modifier masks past button MASK_BUTTON5.
-                        break;
-                }
 
-                // Populate mouse released event.
-                event.time = timestamp;
-                event.reserved = 0x00;
+        __atomic_store_n(&ring.waiting, false, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&dispatch_mutex);
+    }
 
-                event.type = EVENT_MOUSE_RELEASED;
-                event.mask = get_modifiers();
+    return NULL;
+}
 
-                event.data.mouse.button = button;
-                event.data.mouse.clicks = hook->input.mouse.click.count;
-                event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
-                event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
+// Start the dispatch thread for DISPATCH_MODE_ASYNC or open the poll queue.
+static int start_dispatch_thread() {
+    int status = UIOHOOK_SUCCESS;
+
+    if (dispatch_mode == DISPATCH_MODE_POLL) {
+        pthread_mutex_lock(&dispatch_mutex);
+        ring.running = true;
+        pthread_mutex_unlock(&dispatch_mutex);
+    } else if (dispatch_mode == DISPATCH_MODE_ASYNC) {
+        uiohook_event *events = malloc(sizeof(uiohook_event) * dispatch_capacity);
+        if (events != NULL) {
+            pthread_mutex_lock(&dispatch_mutex);
+            reset_ring(events, dispatch_capacity);
+            ring.running = true;
+            pthread_mutex_unlock(&dispatch_mutex);
+
+            if (pthread_create(&dispatch_thread_id, NULL, dispatch_thread_proc, NULL) == 0) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Successfully created dispatch thread.\n",
+                        __FUNCTION__, __LINE__);
+            } else {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to create dispatch thread!\n",
+                        __FUNCTION__, __LINE__);
 
-                #if defined(USE_XINERAMA) || defined(USE_XRANDR)
-                uint8_t count;
-                screen_data *screens = hook_create_screen_info(&count);
-                if (count > 1) {
-                    event.data.mouse.x -= screens[0].x;
-                    event.data.mouse.y -= screens[0].y;
-                }
+                pthread_mutex_lock(&dispatch_mutex);
+                ring.running = false;
+                __atomic_store_n(&ring.events, NULL, __ATOMIC_RELEASE);
+                pthread_mutex_unlock(&dispatch_mutex);
+                free(events);
 
-                if (screens != NULL) {
-                    free(screens);
-                }
-                #endif
+                status = UIOHOOK_FAILURE;
+            }
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for dispatch ring!\n",
+                    __FUNCTION__, __LINE__);
 
-                logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u released %u time(s). (%u, %u)\n",
-                        __FUNCTION__, __LINE__, event.data.mouse.button,
-                        event.data.mouse.clicks,
-                        event.data.mouse.x, event.data.mouse.y);
+            status = UIOHOOK_ERROR_OUT_OF_MEMORY;
+        }
+    }
 
-                // Fire mouse released event.
-                dispatch_event(&event);
+    return status;
+}
 
-                // If the pressed event was not consumed...
-                if (event.reserved ^ 0x01 && hook->input.mouse.is_dragged != true) {
-                    // Populate mouse clicked event.
-                    event.time = timestamp;
-                    event.reserved = 0x00;
-
-                    event.type = EVENT_MOUSE_CLICKED;
-                    event.mask = get_modifiers();
-
-                    event.data.mouse.button = button;
-                    event.data.mouse.clicks = hook->input.mouse.click.count;
-                    event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
-                    event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
-
-                    #if defined(USE_XINERAMA) || defined(USE_XRANDR)
-                    uint8_t count;
-                    screen_data *screens = hook_create_screen_info(&count);
-                    if (count > 1) {
-                        event.data.mouse.x -= screens[0].x;
-                        event.data.mouse.y -= screens[0].y;
-                    }
+// Drain the ring and stop the dispatch thread.  The poll queue keeps any unread
+// events for hook_poll_events().
+static void stop_dispatch_thread() {
+    if (dispatch_mode == DISPATCH_MODE_POLL) {
+        pthread_mutex_lock(&dispatch_mutex);
+        ring.running = false;
+        pthread_mutex_unlock(&dispatch_mutex);
+    } else if (ring.events != NULL) {
+        pthread_mutex_lock(&dispatch_mutex);
+        ring.running = false;
+        pthread_cond_signal(&dispatch_cond);
+        pthread_mutex_unlock(&dispatch_mutex);
+
+        pthread_join(dispatch_thread_id, NULL);
+
+        if (ring.overflow > 0) {
+            logger(LOG_LEVEL_WARN, "%s [%u]: Dispatch ring overflowed %" PRIu64 " time(s)!\n",
+                    __FUNCTION__, __LINE__, ring.overflow);
+        }
 
-                    if (screens != NULL) {
-                        free(screens);
-                    }
-                    #endif
+        pthread_mutex_lock(&dispatch_mutex);
+        uiohook_event *events = ring.events;
+        __atomic_store_n(&ring.events, NULL, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&dispatch_mutex);
+        free(events);
+    }
+}
 
-                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u clicked %u time(s). (%u, %u)\n",
-                            __FUNCTION__, __LINE__, event.data.mouse.button,
-                            event.data.mouse.clicks,
-                            event.data.mouse.x, event.data.mouse.y);
+// Copy up to cap queued events into buffer, returns the number copied.
+static size_t ring_read(uiohook_event *const buffer, size_t cap) {
+    size_t count = 0;
 
-                    // Fire mouse clicked event.
-                    dispatch_event(&event);
-                }
+    uiohook_event *events;
+    uint32_t available;
+    while (count < cap && (available = ring_peek(&events)) > 0) {
+        if (available > cap - count) {
+            available = cap - count;
+        }
+
+        memcpy(&buffer[count], events, sizeof(uiohook_event) * available);
+        ring_release(available);
+        count += available;
+    }
+
+    return count;
+}
 
-                // Reset the number of clicks.
-                if (button == hook->input.mouse.click.button && (long int) (event.time - hook->input.mouse.click.time) > hook_get_multi_click_time()) {
-                    // Reset the click count.
-                    hook->input.mouse.click.count = 0;
+UIOHOOK_API size_t hook_poll_events(uiohook_event *const buffer, size_t cap, int timeout_ms) {
+    size_t count = 0;
+
+    // Keep hook_set_dispatch_mode() from releasing the queue until we are done with it.
+    pthread_mutex_lock(&dispatch_mutex);
+    bool is_polling = dispatch_mode == DISPATCH_MODE_POLL && ring.events != NULL && !ring.polling;
+    bool is_concurrent = ring.polling;
+    if (is_polling) {
+        ring.polling = true;
+    }
+    pthread_mutex_unlock(&dispatch_mutex);
+
+    if (is_concurrent) {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Events are already being polled on another thread!\n",
+                __FUNCTION__, __LINE__);
+    } else if (!is_polling) {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Dispatch mode is not DISPATCH_MODE_POLL!\n",
+                __FUNCTION__, __LINE__);
+    } else if (buffer != NULL && cap > 0) {
+        count = ring_read(buffer, cap);
+
+        if (count == 0 && timeout_ms != 0) {
+            struct timespec ts;
+            if (timeout_ms > 0) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += timeout_ms / 1000;
+                ts.tv_nsec += (long) (timeout_ms % 1000) * 1000 * 1000;
+                if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000 * 1000 * 1000;
                 }
             }
-        } else if (data->type == MotionNotify) {
-            // Reset the click count.
-            if (hook->input.mouse.click.count != 0 && (long int) (timestamp - hook->input.mouse.click.time) > hook_get_multi_click_time()) {
-                hook->input.mouse.click.count = 0;
+
+            // Park the same way the dispatch thread does, ring_push() wakes us.
+            pthread_mutex_lock(&dispatch_mutex);
+            __atomic_store_n(&ring.waiting, true, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+            int wait_status = 0;
+            while (wait_status != ETIMEDOUT && __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE) == ring.head) {
+                if (timeout_ms > 0) {
+                    wait_status = pthread_cond_timedwait(&dispatch_cond, &dispatch_mutex, &ts);
+                } else {
+                    wait_status = pthread_cond_wait(&dispatch_cond, &dispatch_mutex);
+                }
             }
-            
-            // Populate mouse move event.
-            event.time = timestamp;
-            event.reserved = 0x00;
 
-            event.mask = get_modifiers();
+            __atomic_store_n(&ring.waiting, false, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&dispatch_mutex);
+
+            count = ring_read(buffer, cap);
+        }
+
+        count = coalesce_events(buffer, count);
+    }
+
+    if (is_polling) {
+        pthread_mutex_lock(&dispatch_mutex);
+        ring.polling = false;
+        pthread_mutex_unlock(&dispatch_mutex);
+    }
+
+    return count;
+}
+
+// Send out any events collected for the batch dispatcher on the hook thread.
+static inline void flush_dispatch_batch() {
+    if (batch_count > 0) {
+        invoke_dispatcher(batch_events, coalesce_events(batch_events, batch_count));
+        batch_count = 0;
+    }
+
+    batch_deadline = 0;
+}
+
+#ifdef USE_XRECORD_ASYNC
+/* Send out the batch collected by xrecord_block(), except for a motion or wheel run
+ * at its end while a coalescing window is set.  That run is held so the next burst
+ * can still merge into it, but it is sent once the window has passed since it was
+ * first held.  Returns the poll() timeout in ms until then, or -1 if nothing is held.
+ */
+static int flush_dispatch_batch_held() {
+    int timeout = -1;
+
+    // An event that can merge with itself ends a run that may be held.
+    size_t start = batch_count;
+    if (coalesce_window > 0 && batch_count > 0 && can_coalesce(coalesce_flags, &batch_events[batch_count - 1], &batch_events[batch_count - 1])) {
+        start--;
+        while (start > 0 && can_coalesce(coalesce_flags, &batch_events[start - 1], &batch_events[start])) {
+            start--;
+        }
+    }
 
-            // Check the upper half of virtual modifiers for non-zero values and set the mouse
-            // dragged flag.  The last 3 bits are reserved for lock masks.
-            hook->input.mouse.is_dragged = ((event.mask & 0x1F00) > 0);
-            if (hook->input.mouse.is_dragged) {
-                // Create Mouse Dragged event.
-                event.type = EVENT_MOUSE_DRAGGED;
+    if (start == batch_count) {
+        flush_dispatch_batch();
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / (1000 * 1000);
+
+        if (start > 0) {
+            // Everything before the run goes out now and the run starts a new window.
+            invoke_dispatcher(batch_events, coalesce_events(batch_events, start));
+            memmove(batch_events, &batch_events[start], sizeof(uiohook_event) * (batch_count - start));
+            batch_count -= start;
+            batch_deadline = 0;
+        }
+
+        if (batch_deadline == 0) {
+            batch_deadline = now + coalesce_window;
+        }
+
+        if (now >= batch_deadline) {
+            flush_dispatch_batch();
+        } else {
+            timeout = (int) (batch_deadline - now);
+        }
+    }
+
+    return timeout;
+}
+#endif
+
+// Send out an event, either directly or through the dispatch ring.  Not static
+// so the tests can feed the dispatcher without running a hook.
+void dispatch_event(uiohook_event *const event) {
+    if (ring.events != NULL) {
+        if (!ring_push(event)) {
+            if (dispatch_mode == DISPATCH_MODE_ASYNC
+                    && (event->type == EVENT_HOOK_ENABLED || event->type == EVENT_HOOK_DISABLED)) {
+                // Hook state changes are never dropped, wait for the dispatch thread.
+                // This is not done for DISPATCH_MODE_POLL where nobody may be polling.
+                while (!ring_push(event)) {
+                    sched_yield();
+                }
             } else {
-                // Create a Mouse Moved event.
-                event.type = EVENT_MOUSE_MOVED;
+                __atomic_store_n(&ring.overflow, ring.overflow + 1, __ATOMIC_RELAXED);
+
+                logger(LOG_LEVEL_WARN, "%s [%u]: Dispatch ring is full, dropping event type %u!\n",
+                        __FUNCTION__, __LINE__, event->type);
             }
+        }
+    } else if (batch_dispatcher != NULL || coalesce_flags != 0x00) {
+        batch_events[batch_count++] = *event;
+        if (batch_count == DISPATCH_BATCH_SIZE) {
+            flush_dispatch_batch();
+        }
+    } else {
+        invoke_dispatcher(event, 1);
+    }
+}
 
-            event.data.mouse.button = MOUSE_NOBUTTON;
-            event.data.mouse.clicks = hook->input.mouse.click.count;
-            event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
-            event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
+// Set the native modifier mask for future events.
+static inline void set_modifier_mask(uint16_t mask) {
+    hook->input.mask |= mask;
+}
 
-            #if defined(USE_XINERAMA) || defined(USE_XRANDR)
-            uint8_t count;
-            screen_data *screens = hook_create_screen_info(&count);
-            if (count > 1) {
-                event.data.mouse.x -= screens[0].x;
-                event.data.mouse.y -= screens[0].y;
-            }
+// Unset the native modifier mask for future events.
+static inline void unset_modifier_mask(uint16_t mask) {
+    hook->input.mask &= ~mask;
+}
 
-            if (screens != NULL) {
-                free(screens);
-            }
-            #endif
+// Get the current native modifier mask state.
+static inline uint16_t get_modifiers() {
+    return hook->input.mask;
+}
+
+#ifdef USE_XKB_COMMON
+// Lookup the LED indexes for the current xkb_state so lock updates avoid name lookups.
+static void initialize_led_indexes() {
+    led_caps = XKB_LED_INVALID;
+    led_num = XKB_LED_INVALID;
+    led_scroll = XKB_LED_INVALID;
+
+    if (state != NULL) {
+        struct xkb_keymap *keymap = xkb_state_get_keymap(state);
+        led_caps = xkb_keymap_led_get_index(keymap, XKB_LED_NAME_CAPS);
+        led_num = xkb_keymap_led_get_index(keymap, XKB_LED_NAME_NUM);
+        led_scroll = xkb_keymap_led_get_index(keymap, XKB_LED_NAME_SCROLL);
+    }
+}
 
-            logger(LOG_LEVEL_DEBUG, "%s [%u]: Mouse %s to %i, %i. (%#X)\n",
-                    __FUNCTION__, __LINE__, hook->input.mouse.is_dragged ? "dragged" : "moved",
-                    event.data.mouse.x, event.data.mouse.y, event.mask);
+// Set the modifier lock masks from the LEDs tracked by the xkb_state.
+static void update_locks() {
+    if (state != NULL) {
+        if (led_caps != XKB_LED_INVALID && xkb_state_led_index_is_active(state, led_caps) > 0) {
+            set_modifier_mask(MASK_CAPS_LOCK);
+        } else {
+            unset_modifier_mask(MASK_CAPS_LOCK);
+        }
 
-            // Fire mouse move event.
-            dispatch_event(&event);
+        if (led_num != XKB_LED_INVALID && xkb_state_led_index_is_active(state, led_num) > 0) {
+            set_modifier_mask(MASK_NUM_LOCK);
+        } else {
+            unset_modifier_mask(MASK_NUM_LOCK);
+        }
+
+        if (led_scroll != XKB_LED_INVALID && xkb_state_led_index_is_active(state, led_scroll) > 0) {
+            set_modifier_mask(MASK_SCROLL_LOCK);
         } else {
-            // In theory this *should* never execute.
-            logger(LOG_LEVEL_DEBUG, "%s [%u]: Unhandled X11 event: %#X.\n",
-                    __FUNCTION__, __LINE__, (unsigned int) data->type);
+            unset_modifier_mask(MASK_SCROLL_LOCK);
         }
+    }
+}
+#else
+// Set the modifier lock masks from a core keyboard indicator mask.
+static void set_lock_mask(unsigned int led_mask) {
+    if (led_mask & 0x01) {
+        set_modifier_mask(MASK_CAPS_LOCK);
     } else {
-        logger(LOG_LEVEL_WARN, "%s [%u]: Unhandled X11 hook category! (%#X)\n",
-                __FUNCTION__, __LINE__, recorded_data->category);
+        unset_modifier_mask(MASK_CAPS_LOCK);
     }
 
-    // TODO There is no way to consume the XRecord event.
+    if (led_mask & 0x02) {
+        set_modifier_mask(MASK_NUM_LOCK);
+    } else {
+        unset_modifier_mask(MASK_NUM_LOCK);
+    }
 
-    XRecordFreeData(recorded_data);
+    if (led_mask & 0x04) {
+        set_modifier_mask(MASK_SCROLL_LOCK);
+    } else {
+        unset_modifier_mask(MASK_SCROLL_LOCK);
+    }
 }
 
+/* Update the modifier lock masks without a server round-trip.  Lock keys are
+ * toggled locally when pressed and the result is reconciled with the indicator
+ * state reported by XkbIndicatorStateNotify.  Notifications older than the last
+ * local toggle are ignored so they cannot revert a newer key press.
+ */
+static void update_locks(KeySym keysym, bool is_pressed, Time time) {
+    if (is_pressed) {
+        switch (keysym) {
+            case XK_Caps_Lock:
+                hook->input.mask ^= MASK_CAPS_LOCK;
+                hook->input.locks.time = time;
+                break;
+
+            case XK_Num_Lock:
+                hook->input.mask ^= MASK_NUM_LOCK;
+                hook->input.locks.time = time;
+                break;
+
+            case XK_Scroll_Lock:
+                hook->input.mask ^= MASK_SCROLL_LOCK;
+                hook->input.locks.time = time;
+                break;
+        }
+    }
 
-static inline bool enable_key_repeate() {
-    // Attempt to setup detectable autorepeat.
-    // NOTE: is_auto_repeat is NOT stdbool!
-    Bool is_auto_repeat = False;
-
-    // Enable detectable auto-repeat.
-    XkbSetDetectableAutoRepeat(hook->ctrl.display, True, &is_auto_repeat);
+    unsigned int led_mask;
+    Time led_time;
+    unsigned long serial = get_indicator_state(&led_mask, &led_time);
+    if (serial != hook->input.locks.serial) {
+        hook->input.locks.serial = serial;
 
-    return is_auto_repeat;
+        if (led_time >= hook->input.locks.time) {
+            set_lock_mask(led_mask);
+        }
+    }
 }
+#endif
 
+// Initialize the modifier lock masks.
+static void initialize_locks() {
+    #ifdef USE_XKB_COMMON
+    initialize_led_indexes();
+    update_locks();
+    #else
+    // Ignore any indicator notifications received before this query.
+    Time led_time;
+    unsigned int led_mask = 0x00;
+    hook->input.locks.serial = get_indicator_state(&led_mask, &led_time);
+    hook->input.locks.time = CurrentTime;
 
-static inline int xrecord_block() {
-    int status = UIOHOOK_FAILURE;
+    if (XkbGetIndicatorState(hook->ctrl.display, XkbUseCoreKbd, &led_mask) == Success) {
+        set_lock_mask(led_mask);
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: XkbGetIndicatorState failed to get current led mask!\n",
+                __FUNCTION__, __LINE__);
+    }
+    #endif
+}
 
-    // Save the data display associated with this hook so it is passed to each event.
-    //XPointer closeure = (XPointer) (ctrl_display);
-    XPointer closeure = NULL;
+// Initialize the modifier mask to the current modifiers.
+static void initialize_modifiers() {
+    hook->input.mask = 0x0000;
 
-    #ifdef USE_XRECORD_ASYNC
-    // Async requires that we loop so that our thread does not return.
-    if (XRecordEnableContextAsync(hook->data.display, context, hook_event_proc, closeure) != 0) {
-        // Time in MS to sleep the runloop.
-        int timesleep = 100;
+    KeyCode keycode;
+    char keymap[32];
+    XQueryKeymap(hook->ctrl.display, keymap);
 
-        // Allow the thread loop to block.
-        pthread_mutex_lock(&hook_xrecord_mutex);
-        running = true;
+      Window unused_win;
+    int unused_int;
+    unsigned int mask;
+    if (XQueryPointer(hook->ctrl.display, DefaultRootWindow(hook->ctrl.display), &unused_win, &unused_win, &unused_int, &unused_int, &unused_int, &unused_int, &mask)) {
+        if (mask & ShiftMask) {
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_L);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_L); }
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_R);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_R); }
+        }
+        if (mask & ControlMask) {
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_L);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_L);  }
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_R);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_R);  }
+        }
+        if (mask & Mod1Mask) {
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_L);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_L);   }
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_R);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_R);   }
+        }
+        if (mask & Mod4Mask) {
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_L);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_L);  }
+            keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_R);
+            if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_R);  }
+        }
 
-        do {
-            // Unlock the mutex from the previous iteration.
-            pthread_mutex_unlock(&hook_xrecord_mutex);
+        if (mask & Button1Mask) { set_modifier_mask(MASK_BUTTON1); }
+        if (mask & Button2Mask) { set_modifier_mask(MASK_BUTTON2); }
+        if (mask & Button3Mask) { set_modifier_mask(MASK_BUTTON3); }
+        if (mask & Button4Mask) { set_modifier_mask(MASK_BUTTON4); }
+        if (mask & Button5Mask) { set_modifier_mask(MASK_BUTTON5); }
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: XQueryPointer failed to get current modifiers!\n",
+                __FUNCTION__, __LINE__);
+
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_L);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_L); }
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Shift_R);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_SHIFT_R); }
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_L);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_L);  }
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Control_R);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_CTRL_R);  }
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_L);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_L);   }
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Alt_R);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_ALT_R);   }
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_L);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_L);  }
+        keycode = XKeysymToKeycode(hook->ctrl.display, XK_Super_R);
+        if (keymap[keycode / 8] & (1 << (keycode % 8))) { set_modifier_mask(MASK_META_R);  }
+    }
+
+    initialize_locks();
+}
+
+// Translate every device button through the current core pointer mapping.
+static void load_button_descriptors() {
+    unsigned char map[BUTTON_DESCRIPTOR_COUNT];
+    int count = 0;
+    button_descriptor_serial = get_button_map(map, sizeof(map), &count);
+
+    for (int i = 0; i < BUTTON_DESCRIPTOR_COUNT; i++) {
+        // Buttons outside of the mapping are reported unchanged.
+        button_descriptor *descriptor = &button_descriptors[i];
+        descriptor->detail = (i > 0 && i <= count) ? map[i - 1] : (unsigned char) i;
+        descriptor->button = MOUSE_NOBUTTON;
+        descriptor->mask = 0x0000;
+        descriptor->is_wheel = false;
+
+        switch (descriptor->detail) {
+            case Button1:
+                descriptor->button = MOUSE_BUTTON1;
+                descriptor->mask = MASK_BUTTON1;
+                break;
+
+            case Button2:
+                descriptor->button = MOUSE_BUTTON2;
+                descriptor->mask = MASK_BUTTON2;
+                break;
+
+            case Button3:
+                descriptor->button = MOUSE_BUTTON3;
+                descriptor->mask = MASK_BUTTON3;
+                break;
+
+            case WheelUp:
+            case WheelDown:
+            case WheelLeft:
+            case WheelRight:
+                descriptor->is_wheel = true;
+                break;
+
+            case XButton1:
+                descriptor->button = MOUSE_BUTTON4;
+                descriptor->mask = MASK_BUTTON4;
+                break;
+
+            case XButton2:
+                descriptor->button = MOUSE_BUTTON5;
+                descriptor->mask = MASK_BUTTON5;
+                break;
+
+            default:
+                // Do not set modifier masks past button MASK_BUTTON5.
+                break;
+        }
+    }
+
+    logger(LOG_LEVEL_DEBUG, "%s [%u]: Loaded %i button mapping(s).\n",
+            __FUNCTION__, __LINE__, count);
+}
+
+// Lookup a device button, picking up mapping changes made since the last lookup.
+static inline const button_descriptor * get_button_descriptor(unsigned char detail) {
+    if (get_button_map_serial() != button_descriptor_serial) {
+        load_button_descriptors();
+    }
+
+    return &button_descriptors[detail];
+}
+
+/* Rebuild the keyboard map, key descriptors and xkb_state in place when the
+ * settings thread reports a new keyboard mapping.  This runs on the hook thread
+ * so nothing else is reading the tables while they are replaced.
+ */
+static void reload_keyboard_map() {
+    keyboard_map_serial = get_keyboard_map_serial();
+
+    reload_input_helper(hook->ctrl.display);
+
+    #ifdef USE_XKB_COMMON
+    if (state != NULL) {
+        destroy_xkb_state(state);
+        state = NULL;
+    }
+
+    if (hook->input.context != NULL) {
+        state = create_xkb_state(hook->input.context, hook->input.connection);
+    }
+
+    initialize_locks();
+    #endif
+}
+
+// Lookup a key code, picking up keymap changes made since the last lookup.
+static inline const key_descriptor * get_key_descriptor(KeyCode keycode) {
+    // The evdev backend has no control display and compiles its own keymap.
+    if (get_keyboard_map_serial() != keyboard_map_serial && hook->ctrl.display != NULL) {
+        reload_keyboard_map();
+    }
+
+    return &key_descriptors[keycode];
+}
+
+// Fire the hook enabled or disabled event.
+static void dispatch_hook_state(event_type type, uint64_t timestamp) {
+    hook->data.enabled = (type == EVENT_HOOK_ENABLED);
+
+    // Populate the hook state event.
+    event.time = timestamp;
+    event.reserved = 0x00;
+
+    event.type = type;
+    event.mask = 0x00;
+
+    // Fire the hook state event.
+    dispatch_event(&event);
+}
+
+// Translate one core device event into virtual events.
+static void process_device_event(XRecordDatum *data, uint64_t timestamp) {
+    if (data->type == KeyPress) {
+        // The X11 KeyCode associated with this event.
+        KeyCode keycode = (KeyCode) data->event.u.u.detail;
+        const key_descriptor *key = get_key_descriptor(keycode);
+        #if defined(USE_XKB_COMMON)
+        const keysym_entry *entry = keycode_to_keysym_entry(state, keycode);
+        #else
+        const keysym_entry *entry = keycode_to_keysym_entry(keycode, data->event.u.keyButtonPointer.state);
+        #endif
+        KeySym keysym = entry->keysym;
+
+        // Only keys that can produce a character are looked up.
+        uint16_t buffer[2];
+        size_t count =  0;
+        if (key->is_printable) {
+            count = entry->count;
+            memcpy(buffer, entry->unicode, sizeof(buffer));
+        }
+
+        unsigned short int scancode = key->scancode;
+        set_modifier_mask(key->modifier);
+        #ifdef USE_XKB_COMMON
+        if (state != NULL) {
+            xkb_state_update_key(state, keycode, XKB_KEY_DOWN);
+        }
+        update_locks();
+        #else
+        update_locks(keysym, true, (Time) timestamp);
+        #endif
+
+        if (key->is_keypad && (get_modifiers() & MASK_NUM_LOCK) == 0) {
+            scancode |= 0xEE00;
+        }
+
+        // Populate key pressed event.
+        event.time = timestamp;
+        event.reserved = 0x00;
+
+        event.type = EVENT_KEY_PRESSED;
+        event.mask = get_modifiers();
+
+        event.data.keyboard.keycode = scancode;
+        event.data.keyboard.rawcode = keysym;
+        event.data.keyboard.keychar = CHAR_UNDEFINED;
+
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Key %#X pressed. (%#X)\n",
+                __FUNCTION__, __LINE__, event.data.keyboard.keycode, event.data.keyboard.rawcode);
+
+        // Fire key pressed event.
+        dispatch_event(&event);
+
+        // If the pressed event was not consumed...
+        if (event.reserved ^ 0x01) {
+            for (unsigned int i = 0; i < count; i++) {
+                // Populate key typed event.
+                event.time = timestamp;
+                event.reserved = 0x00;
+
+                event.type = EVENT_KEY_TYPED;
+                event.mask = get_modifiers();
+
+                event.data.keyboard.keycode = VC_UNDEFINED;
+                event.data.keyboard.rawcode = keysym;
+                event.data.keyboard.keychar = buffer[i];
+
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Key %#X typed. (%lc)\n",
+                        __FUNCTION__, __LINE__, event.data.keyboard.keycode, (uint16_t) event.data.keyboard.keychar);
+
+                // Fire key typed event.
+                dispatch_event(&event);
+            }
+        }
+    } else if (data->type == KeyRelease) {
+        // The X11 KeyCode associated with this event.
+        KeyCode keycode = (KeyCode) data->event.u.u.detail;
+        const key_descriptor *key = get_key_descriptor(keycode);
+        #ifdef USE_XKB_COMMON
+        KeySym keysym = keycode_to_keysym_entry(state, keycode)->keysym;
+        #else
+        KeySym keysym = keycode_to_keysym_entry(keycode, data->event.u.keyButtonPointer.state)->keysym;
+        #endif
+
+        unsigned short int scancode = key->scancode;
+        unset_modifier_mask(key->modifier);
+        #ifdef USE_XKB_COMMON
+        if (state != NULL) {
+            xkb_state_update_key(state, keycode, XKB_KEY_UP);
+        }
+        update_locks();
+        #else
+        update_locks(keysym, false, (Time) timestamp);
+        #endif
+
+        if (key->is_keypad && (get_modifiers() & MASK_NUM_LOCK) == 0) {
+            scancode |= 0xEE00;
+        }
+
+        // Populate key released event.
+        event.time = timestamp;
+        event.reserved = 0x00;
+
+        event.type = EVENT_KEY_RELEASED;
+        event.mask = get_modifiers();
+
+        event.data.keyboard.keycode = scancode;
+        event.data.keyboard.rawcode = keysym;
+        event.data.keyboard.keychar = CHAR_UNDEFINED;
+
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Key %#X released. (%#X)\n",
+                __FUNCTION__, __LINE__, event.data.keyboard.keycode, event.data.keyboard.rawcode);
+
+        // Fire key released event.
+        dispatch_event(&event);
+    } else if (data->type == ButtonPress) {
+        const button_descriptor *mapped = get_button_descriptor(data->event.u.u.detail);
+
+        // X11 handles wheel events as button events.
+        if (mapped->is_wheel) {
+
+            // Reset the click count and previous button.
+            hook->input.mouse.click.count = 1;
+            hook->input.mouse.click.button = MOUSE_NOBUTTON;
+
+            /* Scroll wheel release events.
+             * Scroll type: WHEEL_UNIT_SCROLL
+             * Scroll amount: 3 unit increments per notch
+             * Units to scroll: 3 unit increments
+             * Vertical unit increment: 15 pixels
+             */
+
+            // Populate mouse wheel event.
+            event.time = timestamp;
+            event.reserved = 0x00;
+
+            event.type = EVENT_MOUSE_WHEEL;
+            event.mask = get_modifiers();
+
+            event.data.wheel.clicks = hook->input.mouse.click.count;
+            event.data.wheel.x = data->event.u.keyButtonPointer.rootX;
+            event.data.wheel.y = data->event.u.keyButtonPointer.rootY;
+
+            #if defined(USE_XINERAMA) || defined(USE_XRANDR)
+            int16_t screen_x, screen_y;
+            if (get_screen_origin(&screen_x, &screen_y)) {
+                event.data.wheel.x -= screen_x;
+                event.data.wheel.y -= screen_y;
+            }
+            #endif
+
+            /* X11 does not have an API call for acquiring the mouse scroll type.  This
+             * maybe part of the XInput2 (XI2) extention but I will wont know until it
+             * is available on my platform.  For the time being we will just use the
+             * unit scroll value.
+             */
+            event.data.wheel.type = WHEEL_UNIT_SCROLL;
+
+            /* Some scroll wheel properties are available via the new XInput2 (XI2)
+             * extension.  Unfortunately the extension is not available on my
+             * development platform at this time.  For the time being we will just
+             * use the Windows default value of 3.
+             */
+            event.data.wheel.amount = 3;
+
+            if (mapped->detail == WheelUp || mapped->detail == WheelLeft) {
+                // Wheel Rotated Up and Away.
+                event.data.wheel.rotation = -1;
+            } else { // mapped->detail == WheelDown || mapped->detail == WheelRight
+                // Wheel Rotated Down and Towards.
+                event.data.wheel.rotation = 1;
+            }
+
+            if (mapped->detail == WheelUp || mapped->detail == WheelDown) {
+                // Wheel Rotated Up or Down.
+                event.data.wheel.direction = WHEEL_VERTICAL_DIRECTION;
+            } else { // mapped->detail == WheelLeft || mapped->detail == WheelRight
+                // Wheel Rotated Left or Right.
+                event.data.wheel.direction = WHEEL_HORIZONTAL_DIRECTION;
+            }
+
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Mouse wheel type %u, rotated %i units in the %u direction at %u, %u.\n",
+                    __FUNCTION__, __LINE__, event.data.wheel.type,
+                    event.data.wheel.amount * event.data.wheel.rotation,
+                    event.data.wheel.direction,
+                    event.data.wheel.x, event.data.wheel.y);
+
+            // Fire mouse wheel event.
+            dispatch_event(&event);
+        } else {
+            // Device events carry the physical button, apply the pointer mapping.
+            uint16_t button = mapped->button;
+            set_modifier_mask(mapped->mask);
+
+
+            // Track the number of clicks, the button must match the previous button.
+            if (button == hook->input.mouse.click.button && (long int) (timestamp - hook->input.mouse.click.time) <= hook_get_multi_click_time()) {
+                if (hook->input.mouse.click.count < USHRT_MAX) {
+                    hook->input.mouse.click.count++;
+                } else {
+                    logger(LOG_LEVEL_WARN, "%s [%u]: Click count overflow detected!\n",
+                            __FUNCTION__, __LINE__);
+                }
+            } else {
+                // Reset the click count.
+                hook->input.mouse.click.count = 1;
+
+                // Set the previous button.
+                hook->input.mouse.click.button = button;
+            }
+
+            // Save this events time to calculate the hook->input.mouse.click.count.
+            hook->input.mouse.click.time = timestamp;
+
+
+            // Populate mouse pressed event.
+            event.time = timestamp;
+            event.reserved = 0x00;
+
+            event.type = EVENT_MOUSE_PRESSED;
+            event.mask = get_modifiers();
+
+            event.data.mouse.button = button;
+            event.data.mouse.clicks = hook->input.mouse.click.count;
+            event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
+            event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
+            event.data.mouse.delta_x = 0;
+            event.data.mouse.delta_y = 0;
+
+            #if defined(USE_XINERAMA) || defined(USE_XRANDR)
+            int16_t screen_x, screen_y;
+            if (get_screen_origin(&screen_x, &screen_y)) {
+                event.data.mouse.x -= screen_x;
+                event.data.mouse.y -= screen_y;
+            }
+            #endif
+
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u  pressed %u time(s). (%u, %u)\n",
+                    __FUNCTION__, __LINE__, event.data.mouse.button, event.data.mouse.clicks,
+                    event.data.mouse.x, event.data.mouse.y);
+
+            // Fire mouse pressed event.
+            dispatch_event(&event);
+        }
+    }
+    else if (data->type == ButtonRelease) {
+        const button_descriptor *mapped = get_button_descriptor(data->event.u.u.detail);
+
+        // X11 handles wheel events as button events.
+        if (!mapped->is_wheel) {
+            // Device events carry the physical button, apply the pointer mapping.
+            uint16_t button = mapped->button;
+            unset_modifier_mask(mapped->mask);
+
+            // Populate mouse released event.
+            event.time = timestamp;
+            event.reserved = 0x00;
+
+            event.type = EVENT_MOUSE_RELEASED;
+            event.mask = get_modifiers();
+
+            event.data.mouse.button = button;
+            event.data.mouse.clicks = hook->input.mouse.click.count;
+            event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
+            event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
+            event.data.mouse.delta_x = 0;
+            event.data.mouse.delta_y = 0;
+
+            #if defined(USE_XINERAMA) || defined(USE_XRANDR)
+            int16_t screen_x, screen_y;
+            if (get_screen_origin(&screen_x, &screen_y)) {
+                event.data.mouse.x -= screen_x;
+                event.data.mouse.y -= screen_y;
+            }
+            #endif
+
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u released %u time(s). (%u, %u)\n",
+                    __FUNCTION__, __LINE__, event.data.mouse.button,
+                    event.data.mouse.clicks,
+                    event.data.mouse.x, event.data.mouse.y);
+
+            // Fire mouse released event.
+            dispatch_event(&event);
+
+            // If the pressed event was not consumed...
+            if (event.reserved ^ 0x01 && hook->input.mouse.is_dragged != true) {
+                // Populate mouse clicked event.
+                event.time = timestamp;
+                event.reserved = 0x00;
+
+                event.type = EVENT_MOUSE_CLICKED;
+                event.mask = get_modifiers();
+
+                event.data.mouse.button = button;
+                event.data.mouse.clicks = hook->input.mouse.click.count;
+                event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
+                event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
+                event.data.mouse.delta_x = 0;
+                event.data.mouse.delta_y = 0;
+
+                #if defined(USE_XINERAMA) || defined(USE_XRANDR)
+                int16_t screen_x, screen_y;
+                if (get_screen_origin(&screen_x, &screen_y)) {
+                    event.data.mouse.x -= screen_x;
+                    event.data.mouse.y -= screen_y;
+                }
+                #endif
+
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Button %u clicked %u time(s). (%u, %u)\n",
+                        __FUNCTION__, __LINE__, event.data.mouse.button,
+                        event.data.mouse.clicks,
+                        event.data.mouse.x, event.data.mouse.y);
+
+                // Fire mouse clicked event.
+                dispatch_event(&event);
+            }
+
+            // Reset the number of clicks.
+            if (button == hook->input.mouse.click.button && (long int) (event.time - hook->input.mouse.click.time) > hook_get_multi_click_time()) {
+                // Reset the click count.
+                hook->input.mouse.click.count = 0;
+            }
+        }
+    } else if (data->type == MotionNotify) {
+        // Reset the click count.
+        if (hook->input.mouse.click.count != 0 && (long int) (timestamp - hook->input.mouse.click.time) > hook_get_multi_click_time()) {
+            hook->input.mouse.click.count = 0;
+        }
+        
+        // Populate mouse move event.
+        event.time = timestamp;
+        event.reserved = 0x00;
+
+        event.mask = get_modifiers();
+
+        // Check the upper half of virtual modifiers for non-zero values and set the mouse
+        // dragged flag.  The last 3 bits are reserved for lock masks.
+        hook->input.mouse.is_dragged = ((event.mask & 0x1F00) > 0);
+        if (hook->input.mouse.is_dragged) {
+            // Create Mouse Dragged event.
+            event.type = EVENT_MOUSE_DRAGGED;
+        } else {
+            // Create a Mouse Moved event.
+            event.type = EVENT_MOUSE_MOVED;
+        }
+
+        event.data.mouse.button = MOUSE_NOBUTTON;
+        event.data.mouse.clicks = hook->input.mouse.click.count;
+        event.data.mouse.x = data->event.u.keyButtonPointer.rootX;
+        event.data.mouse.y = data->event.u.keyButtonPointer.rootY;
+        event.data.mouse.delta_x = hook->input.mouse.delta_x;
+        event.data.mouse.delta_y = hook->input.mouse.delta_y;
+
+        #if defined(USE_XINERAMA) || defined(USE_XRANDR)
+        int16_t screen_x, screen_y;
+        if (get_screen_origin(&screen_x, &screen_y)) {
+            event.data.mouse.x -= screen_x;
+            event.data.mouse.y -= screen_y;
+        }
+        #endif
+
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Mouse %s to %i, %i. (%#X)\n",
+                __FUNCTION__, __LINE__, hook->input.mouse.is_dragged ? "dragged" : "moved",
+                event.data.mouse.x, event.data.mouse.y, event.mask);
+
+        // Fire mouse move event.
+        dispatch_event(&event);
+    } else {
+        // In theory this *should* never execute.
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: Unhandled X11 event: %#X.\n",
+                __FUNCTION__, __LINE__, (unsigned int) data->type);
+    }
+}
+
+void hook_event_proc(XPointer closeure, XRecordInterceptData *recorded_data) {
+    uint64_t timestamp = (uint64_t) recorded_data->server_time;
+
+    if (recorded_data->category == XRecordStartOfData) {
+        dispatch_hook_state(EVENT_HOOK_ENABLED, timestamp);
+    } else if (recorded_data->category == XRecordEndOfData) {
+        dispatch_hook_state(EVENT_HOOK_DISABLED, timestamp);
+    } else if (recorded_data->category == XRecordFromServer || recorded_data->category == XRecordFromClient) {
+        // Get XRecord data.
+        process_device_event((XRecordDatum *) recorded_data->data, timestamp);
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Unhandled X11 hook category! (%#X)\n",
+                __FUNCTION__, __LINE__, recorded_data->category);
+    }
+
+    // TODO There is no way to consume the XRecord event.
+
+    #ifndef USE_XRECORD_ASYNC
+    // Deliver the events produced by this datum, xrecord_block() does this once per
+    // burst of replies when processing asynchronously.
+    flush_dispatch_batch();
+    #endif
+
+    XRecordFreeData(recorded_data);
+}
+
+
+static inline bool enable_key_repeate() {
+    // Attempt to setup detectable autorepeat.
+    // NOTE: is_auto_repeat is NOT stdbool!
+    Bool is_auto_repeat = False;
+
+    // Enable detectable auto-repeat.
+    XkbSetDetectableAutoRepeat(hook->ctrl.display, True, &is_auto_repeat);
+
+    return is_auto_repeat;
+}
+
+
+static inline int xrecord_block() {
+    int status = UIOHOOK_FAILURE;
+
+    // Save the data display associated with this hook so it is passed to each event.
+    //XPointer closeure = (XPointer) (ctrl_display);
+    XPointer closeure = NULL;
+
+    #ifdef USE_XRECORD_ASYNC
+    // Async requires that we loop so that our thread does not return.  The loop
+    // sleeps in poll() until the data display has input or hook_stop() writes to
+    // the wakeup pipe.
+    int wakeup_fds[2] = { -1, -1 };
+    if (pipe(wakeup_fds) != 0) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to create wakeup pipe! (%d)\n",
+                __FUNCTION__, __LINE__, errno);
+    } else if (XRecordEnableContextAsync(hook->data.display, hook->ctrl.context, hook_event_proc, closeure) != 0) {
+        struct pollfd fds[2];
+        fds[0].fd = ConnectionNumber(hook->data.display);
+        fds[0].events = POLLIN;
+        fds[1].fd = wakeup_fds[0];
+        fds[1].events = POLLIN;
+
+        // Allow the thread loop to block.
+        pthread_mutex_lock(&hook_xrecord_mutex);
+        running = true;
+        hook_wakeup_fd = wakeup_fds[1];
+
+        do {
+            // Unlock the mutex from the previous iteration.
+            pthread_mutex_unlock(&hook_xrecord_mutex);
+
+            // Handle every complete reply Xlib can read without blocking, then sleep
+            // until there is more or a held motion or wheel run is due.
+            XRecordProcessReplies(hook->data.display);
+            int timeout = flush_dispatch_batch_held();
+
+            if (poll(fds, 2, timeout) < 0 && errno != EINTR) {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to poll the XRecord data display! (%d)\n",
+                        __FUNCTION__, __LINE__, errno);
+
+                pthread_mutex_lock(&hook_xrecord_mutex);
+                break;
+            }
+
+            pthread_mutex_lock(&hook_xrecord_mutex);
+        } while (running);
+
+        running = false;
+        hook_wakeup_fd = -1;
+
+        // Unlock after loop exit.
+        pthread_mutex_unlock(&hook_xrecord_mutex);
+
+        // The server ignores the data display while the context is enabled, so this
+        // round trip returns once XRecordEndOfData has been passed to hook_event_proc().
+        XSync(hook->data.display, False);
+        flush_dispatch_batch();
+
+        // Set the exit status.
+        status = UIOHOOK_SUCCESS;
+    }
+    #else
+    if (coalesce_flags != 0x00 && ring.events == NULL) {
+        // hook_event_proc() is called per datum without a way to tell where a burst ends.
+        logger(LOG_LEVEL_WARN, "%s [%u]: Coalescing has no effect with synchronous XRecord in DISPATCH_MODE_SYNC!\n",
+                __FUNCTION__, __LINE__);
+    }
+
+    // Sync blocks until XRecordDisableContext() is called.
+    if (XRecordEnableContext(hook->data.display, hook->ctrl.context, hook_event_proc, closeure) != 0) {
+        status = UIOHOOK_SUCCESS;
+    }
+    #endif
+    else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordEnableContext failure!\n",
+            __FUNCTION__, __LINE__);
+
+        // Set the exit status.
+        status = UIOHOOK_ERROR_X_RECORD_ENABLE_CONTEXT;
+    }
+
+    #ifdef USE_XRECORD_ASYNC
+    if (wakeup_fds[0] != -1) {
+        close(wakeup_fds[0]);
+        close(wakeup_fds[1]);
+    }
+    #endif
+
+    return status;
+}
+
+#ifdef USE_XINPUT2
+// Select raw events on the root window, leaving out motion when nobody wants it.
+// XI_Motion and XI_Enter only carry the pointer position for the raw events.
+static void xinput_select_events(Display *display, bool motion) {
+    unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = { 0 };
+    XISetMask(mask_bits, XI_RawKeyPress);
+    XISetMask(mask_bits, XI_RawKeyRelease);
+    XISetMask(mask_bits, XI_RawButtonPress);
+    XISetMask(mask_bits, XI_RawButtonRelease);
+    XISetMask(mask_bits, XI_Enter);
+    if (motion) {
+        XISetMask(mask_bits, XI_RawMotion);
+        XISetMask(mask_bits, XI_Motion);
+    }
+
+    XIEventMask mask;
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof(mask_bits);
+    mask.mask = mask_bits;
+
+    XISelectEvents(display, DefaultRootWindow(display), &mask, 1);
+}
+#endif
+
+/* Pick the last core event to record from what the consumers asked for.  Key and
+ * button events are always recorded because they maintain the modifier and
+ * button state carried by every event, but MotionNotify is by far the busiest
+ * event and is only needed when something wants EVENT_MOUSE_MOVED or
+ * EVENT_MOUSE_DRAGGED.  The single dispatcher, the batch dispatcher and
+ * DISPATCH_MODE_POLL have no event mask, so they always need everything.
+ */
+static unsigned char record_last_event() {
+    uint32_t mask = EVENT_MASK_ALL;
+
+    if (dispatcher == NULL && batch_dispatcher == NULL && dispatch_mode != DISPATCH_MODE_POLL) {
+        subscriber_list *list = __atomic_load_n(&subscribers, __ATOMIC_ACQUIRE);
+        mask = list != NULL ? list->mask : 0;
+    }
+
+    return (mask & EVENT_MASK_MOUSE_MOTION) ? MotionNotify : ButtonRelease;
+}
+
+static void update_record_range() {
+    pthread_mutex_lock(&hook_control_mutex);
+
+    if (hook != NULL && hook->ctrl.display != NULL && hook->ctrl.context != 0 && hook->data.range != NULL) {
+        unsigned char last = record_last_event();
+        if (hook->data.range->device_events.last != last) {
+            hook->data.range->device_events.last = last;
+
+            // Registering the clients again replaces their range on the live context.
+            XRecordClientSpec clients = XRecordAllClients;
+            if (XRecordRegisterClients(hook->ctrl.display, hook->ctrl.context, XRecordFromServerTime, &clients, 1, &hook->data.range, 1) != 0) {
+                XSync(hook->ctrl.display, False);
+
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Recording device events %u through %u.\n",
+                        __FUNCTION__, __LINE__, hook->data.range->device_events.first, last);
+            } else {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordRegisterClients failure!\n",
+                        __FUNCTION__, __LINE__);
+            }
+        }
+    }
+    #ifdef USE_XINPUT2
+    else if (hook != NULL && hook->data.display != NULL && xinput_window != None) {
+        // The selection belongs to the data display's client, Xlib allows this while
+        // the hook thread waits in XNextEvent().
+        xinput_select_events(hook->data.display, record_last_event() == MotionNotify);
+        XFlush(hook->data.display);
+    }
+    #endif
+
+    pthread_mutex_unlock(&hook_control_mutex);
+}
+
+static int xrecord_alloc() {
+    int status = UIOHOOK_FAILURE;
+
+    // Make sure the data display is synchronized to prevent late event delivery!
+    // See Bug 42356 for more information.
+    // https://bugs.freedesktop.org/show_bug.cgi?id=42356#c4
+    XSynchronize(hook->data.display, True);
+
+    // Setup XRecord range.
+    XRecordClientSpec clients = XRecordAllClients;
+
+    hook->data.range = XRecordAllocRange();
+    if (hook->data.range != NULL) {
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: XRecordAllocRange successful.\n",
+                __FUNCTION__, __LINE__);
+
+        hook->data.range->device_events.first = KeyPress;
+        hook->data.range->device_events.last = record_last_event();
+
+        // Note that the documentation for this function is incorrect,
+        // hook->data.display should be used!
+        // See: http://www.x.org/releases/X11R7.6/doc/libXtst/recordlib.txt
+        pthread_mutex_lock(&hook_control_mutex);
+        hook->ctrl.context = XRecordCreateContext(hook->data.display, XRecordFromServerTime, &clients, 1, &hook->data.range, 1);
+        pthread_mutex_unlock(&hook_control_mutex);
+        if (hook->ctrl.context != 0) {
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: XRecordCreateContext successful.\n",
+                    __FUNCTION__, __LINE__);
+
+            status = UIOHOOK_SUCCESS;
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordCreateContext failure!\n",
+                    __FUNCTION__, __LINE__);
+
+            // Free the XRecord range.
+            pthread_mutex_lock(&hook_control_mutex);
+            XFree(hook->data.range);
+            hook->data.range = NULL;
+            pthread_mutex_unlock(&hook_control_mutex);
+
+            // Set the exit status.
+            status = UIOHOOK_ERROR_X_RECORD_CREATE_CONTEXT;
+        }
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordAllocRange failure!\n",
+                __FUNCTION__, __LINE__);
+
+        // Set the exit status.
+        status = UIOHOOK_ERROR_X_RECORD_ALLOC_RANGE;
+    }
+
+    return status;
+}
+
+static void xrecord_free() {
+    pthread_mutex_lock(&hook_control_mutex);
+
+    // Free up the context if it was set.
+    if (hook->ctrl.context != 0) {
+        XRecordFreeContext(hook->data.display, hook->ctrl.context);
+        hook->ctrl.context = 0;
+    }
+
+    // Free the XRecord range.
+    if (hook->data.range != NULL) {
+        XFree(hook->data.range);
+        hook->data.range = NULL;
+    }
+
+    pthread_mutex_unlock(&hook_control_mutex);
+}
+
+static int xrecord_query() {
+    int status = UIOHOOK_FAILURE;
+
+    // Check to make sure XRecord is installed and enabled.
+    int major, minor;
+    if (XRecordQueryVersion(hook->ctrl.display, &major, &minor) != 0) {
+        logger(LOG_LEVEL_INFO, "%s [%u]: XRecord version: %i.%i.\n",
+                __FUNCTION__, __LINE__, major, minor);
+
+        status = UIOHOOK_SUCCESS;
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: XRecord is not currently available!\n",
+                __FUNCTION__, __LINE__);
+
+        status = UIOHOOK_ERROR_X_RECORD_NOT_FOUND;
+    }
+
+    return status;
+}
+
+static int xrecord_open() {
+    int status = UIOHOOK_FAILURE;
+
+    // Open the control display for XRecord.
+    hook->ctrl.display = XOpenDisplay(NULL);
+
+    // Open a data display for XRecord.
+    // NOTE This display must be opened on the same thread as XRecord.
+    hook->data.display = XOpenDisplay(NULL);
+    if (hook->ctrl.display != NULL && hook->data.display != NULL) {
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: XOpenDisplay successful.\n",
+                __FUNCTION__, __LINE__);
+
+        bool is_auto_repeat = enable_key_repeate();
+        if (is_auto_repeat) {
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Successfully enabled detectable auto-repeat.\n",
+                    __FUNCTION__, __LINE__);
+        } else {
+            logger(LOG_LEVEL_WARN, "%s [%u]: Could not enable detectable auto-repeat!\n",
+                    __FUNCTION__, __LINE__);
+        }
+
+        #if defined(USE_XKB_COMMON)
+        // Open XCB Connection
+        hook->input.connection = XGetXCBConnection(hook->ctrl.display);
+        int xcb_status = xcb_connection_has_error(hook->input.connection);
+        if (xcb_status <= 0) {
+            // Initialize xkbcommon context.
+            struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+
+            if (context != NULL) {
+                hook->input.context = xkb_context_ref(context);
+            } else {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: xkb_context_new failure!\n",
+                        __FUNCTION__, __LINE__);
+            }
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: xcb_connect failure! (%d)\n",
+                    __FUNCTION__, __LINE__, xcb_status);
+        }
+        #endif
+
+        // Changes after this point are picked up by get_key_descriptor().
+        keyboard_map_serial = get_keyboard_map_serial();
+
+        #ifdef USE_XKB_COMMON
+        if (hook->input.context != NULL) {
+            state = create_xkb_state(hook->input.context, hook->input.connection);
+        }
+        #endif
+
+        // Initialize starting modifiers.
+        initialize_modifiers();
+
+        status = UIOHOOK_SUCCESS;
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: XOpenDisplay failure!\n",
+                __FUNCTION__, __LINE__);
+
+        status = UIOHOOK_ERROR_X_OPEN_DISPLAY;
+    }
+
+    return status;
+}
+
+static void xrecord_close() {
+    #ifdef USE_XKB_COMMON
+    if (state != NULL) {
+        destroy_xkb_state(state);
+        state = NULL;
+    }
+
+    if (hook->input.context != NULL) {
+        xkb_context_unref(hook->input.context);
+        hook->input.context = NULL;
+    }
+    #endif
+
+    // Close down the XRecord data display.
+    if (hook->data.display != NULL) {
+        XCloseDisplay(hook->data.display);
+        hook->data.display = NULL;
+    }
+
+    // Close down the XRecord control display.
+    if (hook->ctrl.display) {
+        XCloseDisplay(hook->ctrl.display);
+        hook->ctrl.display = NULL;
+    }
+}
+
+#ifdef USE_XCB_RECORD
+// Read a CARD32 from the reply data in the byte order of the recorded client.
+static inline uint32_t xcb_record_card32(const uint8_t *data, bool swapped) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+
+    if (swapped) {
+        value = ((value & 0x000000FF) << 24) | ((value & 0x0000FF00) << 8)
+              | ((value & 0x00FF0000) >> 8) | ((value & 0xFF000000) >> 24);
+    }
+
+    return value;
+}
+
+// Translate every intercepted protocol element carried by a single reply.
+static void xcb_record_process_reply(xcb_record_enable_context_reply_t *reply) {
+    uint64_t timestamp = (uint64_t) reply->server_time;
+
+    if (reply->category == XRecordStartOfData) {
+        dispatch_hook_state(EVENT_HOOK_ENABLED, timestamp);
+    } else if (reply->category == XRecordEndOfData) {
+        dispatch_hook_state(EVENT_HOOK_DISABLED, timestamp);
+    } else if (reply->category == XRecordFromServer) {
+        const uint8_t *data = xcb_record_enable_context_data(reply);
+        int length = xcb_record_enable_context_data_length(reply);
+        bool has_time = (reply->element_header & XCB_RECORD_H_TYPE_FROM_SERVER_TIME) != 0;
+        int element_size = sizeof(xEvent) + (has_time ? sizeof(uint32_t) : 0);
+
+        /* Only core device events are in the range, so the reply is a packed array
+         * of 32 byte xEvents, each prefixed by its server time.  The events are
+         * parsed in place instead of being copied into an XRecordInterceptData
+         * allocation one at a time. */
+        XRecordDatum datum;
+        for (int offset = 0; offset + element_size <= length; offset += element_size) {
+            if (has_time) {
+                timestamp = (uint64_t) xcb_record_card32(data + offset, reply->client_swapped);
+            }
+
+            // Copy to keep the xEvent aligned, the protocol only guarantees 4 bytes.
+            memcpy(&datum, data + offset + (element_size - sizeof(xEvent)), sizeof(xEvent));
+            process_device_event(&datum, timestamp);
+        }
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: Unhandled X11 hook category! (%#X)\n",
+                __FUNCTION__, __LINE__, reply->category);
+    }
+}
+
+/* Record with xcb-record on the data display's XCB connection.  Each
+ * RecordEnableContext reply is parsed straight out of the buffer XCB returns, so
+ * there is no XRecordInterceptData allocation per event and the data path never
+ * takes the Xlib display lock.  hook_stop() still disables the context through
+ * the Xlib control display, which ends the reply stream. */
+static int xcb_record_block() {
+    int status = UIOHOOK_FAILURE;
+
+    xcb_connection_t *connection = XGetXCBConnection(hook->data.display);
+
+    // Keep an Xlib copy of the range so update_record_range() can change it later.
+    hook->data.range = XRecordAllocRange();
+    if (hook->data.range != NULL) {
+        hook->data.range->device_events.first = KeyPress;
+        hook->data.range->device_events.last = record_last_event();
+
+        xcb_record_range_t range;
+        memset(&range, 0, sizeof(range));
+        range.device_events.first = hook->data.range->device_events.first;
+        range.device_events.last = hook->data.range->device_events.last;
+
+        xcb_record_client_spec_t clients = XCB_RECORD_CS_ALL_CLIENTS;
+        xcb_record_context_t context = xcb_generate_id(connection);
+        xcb_generic_error_t *error = xcb_request_check(connection,
+                xcb_record_create_context_checked(connection, context, XCB_RECORD_H_TYPE_FROM_SERVER_TIME, 1, 1, &clients, &range));
+
+        if (error == NULL) {
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: xcb_record_create_context successful.\n",
+                    __FUNCTION__, __LINE__);
+
+            pthread_mutex_lock(&hook_control_mutex);
+            hook->ctrl.context = context;
+            pthread_mutex_unlock(&hook_control_mutex);
+
+            // Blocks in the reply loop until XRecordDisableContext() is called.
+            xcb_record_enable_context_cookie_t cookie = xcb_record_enable_context(connection, context);
+
+            xcb_record_enable_context_reply_t *reply;
+            while ((reply = xcb_record_enable_context_reply(connection, cookie, &error)) != NULL) {
+                bool is_end = (reply->category == XRecordEndOfData);
+
+                xcb_record_process_reply(reply);
+                flush_dispatch_batch();
+                free(reply);
+
+                if (is_end) {
+                    break;
+                }
+            }
+
+            if (error != NULL) {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: xcb_record_enable_context failure! (%u)\n",
+                        __FUNCTION__, __LINE__, error->error_code);
+
+                free(error);
+
+                // Set the exit status.
+                status = UIOHOOK_ERROR_X_RECORD_ENABLE_CONTEXT;
+            } else {
+                status = UIOHOOK_SUCCESS;
+            }
+
+            // The context belongs to this connection, free it here instead of xrecord_free().
+            pthread_mutex_lock(&hook_control_mutex);
+            xcb_record_free_context(connection, context);
+            xcb_flush(connection);
+            hook->ctrl.context = 0;
+            pthread_mutex_unlock(&hook_control_mutex);
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: xcb_record_create_context failure! (%u)\n",
+                    __FUNCTION__, __LINE__, error->error_code);
+
+            free(error);
+
+            // Set the exit status.
+            status = UIOHOOK_ERROR_X_RECORD_CREATE_CONTEXT;
+        }
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordAllocRange failure!\n",
+                __FUNCTION__, __LINE__);
+
+        // Set the exit status.
+        status = UIOHOOK_ERROR_X_RECORD_ALLOC_RANGE;
+    }
+
+    return status;
+}
+#endif
+
+static int xrecord_start() {
+    int status = xrecord_open();
+    if (status == UIOHOOK_SUCCESS) {
+        status = xrecord_query();
+    }
+
+    #ifdef USE_XCB_RECORD
+    if (status == UIOHOOK_SUCCESS) {
+        // Block until hook_stop() is called.
+        status = xcb_record_block();
+
+        xrecord_free();
+    }
+    #else
+    if (status == UIOHOOK_SUCCESS) {
+        status = xrecord_alloc();
+    }
+
+    if (status == UIOHOOK_SUCCESS) {
+        // Block until hook_stop() is called.
+        status = xrecord_block();
+
+        xrecord_free();
+    }
+    #endif
+
+    xrecord_close();
+
+    return status;
+}
+
+#ifdef USE_XINPUT2
+// Synchronize the tracked pointer position with the server when the hook starts.
+static void xinput_query_pointer() {
+    Window unused_win;
+    int root_x, root_y, unused_int;
+    unsigned int unused_mask;
+
+    Display *display = hook->data.display;
+    if (XQueryPointer(display, DefaultRootWindow(display), &unused_win, &unused_win, &root_x, &root_y, &unused_int, &unused_int, &unused_mask)) {
+        xinput_x = root_x;
+        xinput_y = root_y;
+    }
+}
+
+// Round a valuator value to the nearest int16_t.
+static inline int16_t xinput_round(double value) {
+    if (value > INT16_MAX) {
+        value = INT16_MAX;
+    } else if (value < INT16_MIN) {
+        value = INT16_MIN;
+    }
+
+    return (int16_t) (value < 0 ? value - 0.5 : value + 0.5);
+}
+
+// Fill in the state the core event would have carried and process it.
+static void xinput_dispatch(XRecordDatum *data, Time time) {
+    data->event.u.keyButtonPointer.state = XkbBuildCoreState(xinput_mods, xinput_group);
+    data->event.u.keyButtonPointer.rootX = (INT16) xinput_x;
+    data->event.u.keyButtonPointer.rootY = (INT16) xinput_y;
+
+    process_device_event(data, (uint64_t) time);
+}
+
+// Deliver the pending raw motion at the last known pointer position.
+static void xinput_flush_motion() {
+    if (xinput_motion_pending) {
+        xinput_motion_pending = false;
+
+        XRecordDatum data;
+        memset(&data, 0, sizeof(data));
+        data.type = MotionNotify;
+
+        hook->input.mouse.delta_x = xinput_round(xinput_motion_x);
+        hook->input.mouse.delta_y = xinput_round(xinput_motion_y);
+        xinput_motion_x = 0;
+        xinput_motion_y = 0;
+
+        xinput_dispatch(&data, xinput_motion_time);
+
+        hook->input.mouse.delta_x = 0;
+        hook->input.mouse.delta_y = 0;
+    }
+}
+
+// Translate a raw event into the core event the XRecord backend would have seen.
+static void xinput_process_raw(int evtype, XIRawEvent *raw) {
+    XRecordDatum data;
+    memset(&data, 0, sizeof(data));
+
+    xinput_time = raw->time;
+
+    // Keep the order of the events, a motion still waiting for its position goes first.
+    xinput_flush_motion();
+
+    bool is_valid = true;
+    switch (evtype) {
+        case XI_RawKeyPress:
+            data.type = KeyPress;
+            break;
+
+        case XI_RawKeyRelease:
+            data.type = KeyRelease;
+            break;
+
+        case XI_RawButtonPress:
+            data.type = ButtonPress;
+            break;
+
+        case XI_RawButtonRelease:
+            data.type = ButtonRelease;
+            break;
+
+        case XI_RawMotion:
+            // Only the values of set valuators are sent, in axis order.
+            is_valid = false;
+            int index = 0;
+            for (int axis = 0; axis < raw->valuators.mask_len * 8 && axis <= 1; axis++) {
+                if (XIMaskIsSet(raw->valuators.mask, axis)) {
+                    if (axis == 0) {
+                        xinput_motion_x = raw->raw_values[index];
+                    } else {
+                        xinput_motion_y = raw->raw_values[index];
+                    }
+
+                    xinput_motion_pending = true;
+                    xinput_motion_time = raw->time;
+                    index++;
+                }
+            }
+            break;
+
+        default:
+            is_valid = false;
+            break;
+    }
+
+    if (is_valid) {
+        data.event.u.u.detail = (BYTE) raw->detail;
+        xinput_dispatch(&data, raw->time);
+    }
+}
+
+/* Track the pointer position from the events the server sends to the root window.
+ * The XI_Motion for a raw motion follows it directly unless a window below the
+ * pointer selected XI_Motion itself, XI_Enter resynchronizes the position when
+ * the pointer comes back to the root window or another screen.  Warps are
+ * reported as XI_Motion too.
+ */
+static void xinput_process_pointer(int evtype, void *event) {
+    if (evtype == XI_Motion) {
+        XIDeviceEvent *motion = (XIDeviceEvent *) event;
+        xinput_x = xinput_round(motion->root_x);
+        xinput_y = xinput_round(motion->root_y);
+        xinput_time = motion->time;
+
+        xinput_flush_motion();
+    } else if (evtype == XI_Enter) {
+        XIEnterEvent *enter = (XIEnterEvent *) event;
+        xinput_x = xinput_round(enter->root_x);
+        xinput_y = xinput_round(enter->root_y);
+        xinput_time = enter->time;
+    }
+}
+
+static int xinput_block() {
+    Display *display = hook->data.display;
+
+    // Track the keyboard state that core events would have carried.
+    XkbSelectEventDetails(display, XkbUseCoreKbd, XkbStateNotify,
+            XkbModifierStateMask | XkbGroupStateMask, XkbModifierStateMask | XkbGroupStateMask);
+
+    XkbStateRec xkb_state;
+    if (XkbGetState(display, XkbUseCoreKbd, &xkb_state) == Success) {
+        xinput_mods = xkb_state.mods;
+        xinput_group = xkb_state.group;
+    }
+
+    xinput_query_pointer();
+    xinput_motion_pending = false;
+    xinput_motion_x = 0;
+    xinput_motion_y = 0;
+    xinput_time = CurrentTime;
+
+    // hook_stop() sends a client message to this window to wake XNextEvent().
+    xinput_stop_atom = XInternAtom(display, "_UIOHOOK_HOOK_STOP", False);
+    Window window = XCreateSimpleWindow(display, DefaultRootWindow(display), 0, 0, 1, 1, 0, 0, 0);
+
+    xinput_select_events(display, record_last_event() == MotionNotify);
+    XSync(display, False);
+
+    pthread_mutex_lock(&hook_control_mutex);
+    xinput_window = window;
+    pthread_mutex_unlock(&hook_control_mutex);
+
+    dispatch_hook_state(EVENT_HOOK_ENABLED, (uint64_t) xinput_time);
+    flush_dispatch_batch();
+
+    bool running = true;
+    while (running) {
+        XEvent ev;
+        XNextEvent(display, &ev);
+
+        if (ev.type == GenericEvent && ev.xcookie.extension == xinput_opcode) {
+            if (XGetEventData(display, &ev.xcookie)) {
+                if (ev.xcookie.evtype == XI_Motion || ev.xcookie.evtype == XI_Enter) {
+                    xinput_process_pointer(ev.xcookie.evtype, ev.xcookie.data);
+                } else {
+                    xinput_process_raw(ev.xcookie.evtype, (XIRawEvent *) ev.xcookie.data);
+                }
+                XFreeEventData(display, &ev.xcookie);
+            }
+        } else if (ev.type == xinput_xkb_event) {
+            XkbEvent *xkb_event = (XkbEvent *) &ev;
+            if (xkb_event->any.xkb_type == XkbStateNotify) {
+                xinput_mods = xkb_event->state.mods;
+                xinput_group = xkb_event->state.group;
+            }
+        } else if (ev.type == ClientMessage && ev.xclient.window == window && ev.xclient.message_type == xinput_stop_atom) {
+            running = false;
+        }
+
+        // Nothing is left to read, the raw motion will not get its XI_Motion.
+        if (xinput_motion_pending && XEventsQueued(display, QueuedAfterReading) == 0) {
+            xinput_flush_motion();
+        }
+
+        // Deliver a burst of events as one batch.
+        if (XEventsQueued(display, QueuedAlready) == 0) {
+            flush_dispatch_batch();
+        }
+    }
+
+    xinput_flush_motion();
+
+    pthread_mutex_lock(&hook_control_mutex);
+    xinput_window = None;
+    pthread_mutex_unlock(&hook_control_mutex);
+
+    dispatch_hook_state(EVENT_HOOK_DISABLED, (uint64_t) xinput_time);
+    flush_dispatch_batch();
+
+    XDestroyWindow(display, window);
+
+    return UIOHOOK_SUCCESS;
+}
+
+// Wake xinput_block() out of XNextEvent() with a client message.
+static int xinput_stop() {
+    int status = UIOHOOK_FAILURE;
+
+    pthread_mutex_lock(&hook_control_mutex);
+    if (hook != NULL && hook->ctrl.display != NULL && xinput_window != None) {
+        XEvent stop;
+        memset(&stop, 0, sizeof(stop));
+        stop.xclient.type = ClientMessage;
+        stop.xclient.window = xinput_window;
+        stop.xclient.message_type = xinput_stop_atom;
+        stop.xclient.format = 32;
+
+        if (XSendEvent(hook->ctrl.display, xinput_window, False, NoEventMask, &stop) != 0) {
+            XSync(hook->ctrl.display, False);
+            status = UIOHOOK_SUCCESS;
+        }
+    }
+    pthread_mutex_unlock(&hook_control_mutex);
+
+    return status;
+}
+
+// Run the hook on XInput2 raw events, returns UIOHOOK_FAILURE if XInput 2 is
+// not available so the caller can fall back to XRecord.
+static int xinput_start() {
+    int status = xrecord_open();
+    if (status == UIOHOOK_SUCCESS) {
+        int event_base, error_base, major = 2, minor = 0;
+        if (!XQueryExtension(hook->data.display, "XInputExtension", &xinput_opcode, &event_base, &error_base)) {
+            logger(LOG_LEVEL_WARN, "%s [%u]: XInput is not currently available!\n",
+                    __FUNCTION__, __LINE__);
+
+            status = UIOHOOK_FAILURE;
+        } else if (XIQueryVersion(hook->data.display, &major, &minor) != Success) {
+            logger(LOG_LEVEL_WARN, "%s [%u]: XInput 2 is not supported! (%i.%i)\n",
+                    __FUNCTION__, __LINE__, major, minor);
+
+            status = UIOHOOK_FAILURE;
+        } else if (!XkbQueryExtension(hook->data.display, NULL, &xinput_xkb_event, NULL, NULL, NULL)) {
+            logger(LOG_LEVEL_WARN, "%s [%u]: XKB is not currently available!\n",
+                    __FUNCTION__, __LINE__);
+
+            status = UIOHOOK_FAILURE;
+        } else {
+            logger(LOG_LEVEL_INFO, "%s [%u]: XInput version: %i.%i.\n",
+                    __FUNCTION__, __LINE__, major, minor);
+
+            // Block until hook_stop() is called.
+            status = xinput_block();
+        }
+    }
+
+    xrecord_close();
+
+    return status;
+}
+#endif
+
+#ifdef USE_EVDEV
+// Milliseconds since the epoch, the clock evdev uses for its event times.
+static uint64_t evdev_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Build the core modifier state an X server would have sent with the event.
+static unsigned int evdev_core_state() {
+    uint16_t mask = get_modifiers();
+    unsigned int core_state = 0;
+
+    if (mask & (MASK_SHIFT))      { core_state |= ShiftMask;   }
+    if (mask & (MASK_CTRL))       { core_state |= ControlMask; }
+    if (mask & (MASK_ALT))        { core_state |= Mod1Mask;    }
+    if (mask & (MASK_META))       { core_state |= Mod4Mask;    }
+    if (mask & (MASK_CAPS_LOCK))  { core_state |= LockMask;    }
+    if (mask & (MASK_NUM_LOCK))   { core_state |= Mod2Mask;    }
+    if (mask & (MASK_BUTTON1))    { core_state |= Button1Mask; }
+    if (mask & (MASK_BUTTON2))    { core_state |= Button2Mask; }
+    if (mask & (MASK_BUTTON3))    { core_state |= Button3Mask; }
+
+    return core_state;
+}
+
+// Translate an evdev event into the core event the XRecord backend would have seen.
+static void evdev_dispatch(unsigned char type, unsigned char detail, uint64_t timestamp) {
+    XRecordDatum data;
+    memset(&data, 0, sizeof(data));
+
+    data.type = type;
+    data.event.u.u.detail = detail;
+    data.event.u.keyButtonPointer.state = evdev_core_state();
+    data.event.u.keyButtonPointer.rootX = (INT16) evdev_x;
+    data.event.u.keyButtonPointer.rootY = (INT16) evdev_y;
+
+    process_device_event(&data, timestamp);
+}
+
+// Clamp the tracked pointer position to the screen, or to int16_t if it is unknown.
+static inline int32_t evdev_clamp(int32_t value, int32_t size) {
+    int32_t min = size > 0 ? 0 : INT16_MIN;
+    int32_t max = size > 0 ? size - 1 : INT16_MAX;
+
+    if (value < min) {
+        value = min;
+    } else if (value > max) {
+        value = max;
+    }
+
+    return value;
+}
+
+// Scale an absolute axis onto the screen, the raw value is used if either range is unknown.
+static inline int32_t evdev_scale(const struct input_absinfo *info, int32_t value, int32_t size) {
+    if (size > 0 && info->maximum > info->minimum) {
+        value = (int32_t) ((int64_t) (value - info->minimum) * (size - 1) / (info->maximum - info->minimum));
+    }
+
+    return value;
+}
+
+// Fire the motion accumulated since the last report, if anything wants it.
+static void evdev_flush_motion(uint64_t timestamp) {
+    if (evdev_moved) {
+        if (record_last_event() == MotionNotify) {
+            hook->input.mouse.delta_x = (int16_t) evdev_clamp(evdev_delta_x, 0);
+            hook->input.mouse.delta_y = (int16_t) evdev_clamp(evdev_delta_y, 0);
+
+            evdev_dispatch(MotionNotify, 0, timestamp);
+
+            hook->input.mouse.delta_x = 0;
+            hook->input.mouse.delta_y = 0;
+        }
+
+        evdev_moved = false;
+        evdev_delta_x = 0;
+        evdev_delta_y = 0;
+    }
+}
+
+static void evdev_process_event(struct _evdev_device *device, const struct input_event *ev) {
+    uint64_t timestamp = (uint64_t) ev->input_event_sec * 1000 + ev->input_event_usec / 1000;
+
+    if (ev->type == EV_KEY) {
+        unsigned char button = 0;
+        switch (ev->code) {
+            case BTN_LEFT:
+            case BTN_TOUCH:
+                button = Button1;
+                break;
+
+            case BTN_MIDDLE:
+                button = Button2;
+                break;
+
+            case BTN_RIGHT:
+                button = Button3;
+                break;
+
+            case BTN_SIDE:
+                button = XButton1;
+                break;
+
+            case BTN_EXTRA:
+                button = XButton2;
+                break;
+        }
+
+        if (button != 0) {
+            // Buttons are pressed where the pointer is at the end of the frame so far.
+            if (ev->value != 2) {
+                evdev_flush_motion(timestamp);
+                evdev_dispatch(ev->value ? ButtonPress : ButtonRelease, button, timestamp);
+            }
+        } else if (ev->code + 8 <= UCHAR_MAX) {
+            // Repeats are sent as presses, like detectable auto-repeat does.
+            evdev_dispatch(ev->value ? KeyPress : KeyRelease, ev->code + 8, timestamp);
+        }
+    } else if (ev->type == EV_REL) {
+        if (ev->code == REL_X || ev->code == REL_Y) {
+            if (ev->code == REL_X) {
+                evdev_x = evdev_clamp(evdev_x + ev->value, evdev_width);
+                evdev_delta_x += ev->value;
+            } else {
+                evdev_y = evdev_clamp(evdev_y + ev->value, evdev_height);
+                evdev_delta_y += ev->value;
+            }
+
+            evdev_moved = true;
+        } else if (ev->code == REL_WHEEL || ev->code == REL_HWHEEL) {
+            unsigned char button;
+            if (ev->code == REL_WHEEL) {
+                button = ev->value > 0 ? WheelUp : WheelDown;
+            } else {
+                button = ev->value > 0 ? WheelRight : WheelLeft;
+            }
+
+            // One wheel event per notch, the wheel never sends a release.
+            evdev_flush_motion(timestamp);
+            for (int32_t i = abs(ev->value); i > 0; i--) {
+                evdev_dispatch(ButtonPress, button, timestamp);
+            }
+        }
+    } else if (ev->type == EV_ABS) {
+        if (ev->code == ABS_X) {
+            int32_t x = evdev_clamp(evdev_scale(&device->abs_x, ev->value, evdev_width), evdev_width);
+            evdev_delta_x += x - evdev_x;
+            evdev_x = x;
+            evdev_moved = true;
+        } else if (ev->code == ABS_Y) {
+            int32_t y = evdev_clamp(evdev_scale(&device->abs_y, ev->value, evdev_height), evdev_height);
+            evdev_delta_y += y - evdev_y;
+            evdev_y = y;
+            evdev_moved = true;
+        }
+    } else if (ev->type == EV_SYN && ev->code == SYN_REPORT) {
+        evdev_flush_motion(timestamp);
+    }
+}
+
+// Read whatever is available and process the complete records, returns false at end of file.
+static bool evdev_read(struct _evdev_device *device) {
+    bool is_open = true;
+
+    ssize_t size = read(device->fd, device->buffer + device->pending, sizeof(device->buffer) - device->pending);
+    if (size > 0) {
+        size_t length = device->pending + (size_t) size;
+
+        // Pipes and FIFOs may split a record between reads, keep the tail for the next one.
+        size_t offset = 0;
+        for (; offset + sizeof(struct input_event) <= length; offset += sizeof(struct input_event)) {
+            struct input_event ev;
+            memcpy(&ev, device->buffer + offset, sizeof(ev));
+            evdev_process_event(device, &ev);
+        }
+
+        device->pending = length - offset;
+        memmove(device->buffer, device->buffer + offset, device->pending);
+    } else if (size == 0 || (errno != EINTR && errno != EAGAIN)) {
+        is_open = false;
+    }
+
+    return is_open;
+}
+
+static void evdev_add_device(int fd, bool owned) {
+    struct _evdev_device *device = &evdev_devices[evdev_device_count++];
+    device->fd = fd;
+    device->owned = owned;
+    device->pending = 0;
+
+    // Plain files and FIFOs have no axis information and report raw positions.
+    memset(&device->abs_x, 0, sizeof(device->abs_x));
+    memset(&device->abs_y, 0, sizeof(device->abs_y));
+    ioctl(fd, EVIOCGABS(ABS_X), &device->abs_x);
+    ioctl(fd, EVIOCGABS(ABS_Y), &device->abs_y);
+}
+
+// Open every keyboard and pointer under /dev/input that this process may read.
+static void evdev_open_devices() {
+    DIR *dir = opendir("/dev/input");
+    if (dir != NULL) {
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL && evdev_device_count < EVDEV_MAX_DEVICES) {
+            if (strncmp(entry->d_name, "event", 5) == 0) {
+                char path[sizeof("/dev/input/") + sizeof(entry->d_name)];
+                snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+
+                int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+                if (fd >= 0) {
+                    unsigned long types = 0;
+                    if (ioctl(fd, EVIOCGBIT(0, sizeof(types)), &types) >= 0
+                            && (types & ((1UL << EV_KEY) | (1UL << EV_REL) | (1UL << EV_ABS)))) {
+                        logger(LOG_LEVEL_DEBUG, "%s [%u]: Opened input device %s.\n",
+                                __FUNCTION__, __LINE__, path);
+
+                        evdev_add_device(fd, true);
+                    } else {
+                        close(fd);
+                    }
+                } else {
+                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Failed to open input device %s! (%d)\n",
+                            __FUNCTION__, __LINE__, path, errno);
+                }
+            }
+        }
+
+        closedir(dir);
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to open /dev/input! (%d)\n",
+                __FUNCTION__, __LINE__, errno);
+    }
+}
 
-            XRecordProcessReplies(hook->data.display);
+// Initialize the modifier mask from the keys, buttons and LEDs the devices report.
+static void evdev_initialize_modifiers() {
+    static const struct {
+        uint16_t code;
+        uint16_t mask;
+    } modifiers[] = {
+        { KEY_LEFTSHIFT,  MASK_SHIFT_L },
+        { KEY_RIGHTSHIFT, MASK_SHIFT_R },
+        { KEY_LEFTCTRL,   MASK_CTRL_L  },
+        { KEY_RIGHTCTRL,  MASK_CTRL_R  },
+        { KEY_LEFTALT,    MASK_ALT_L   },
+        { KEY_RIGHTALT,   MASK_ALT_R   },
+        { KEY_LEFTMETA,   MASK_META_L  },
+        { KEY_RIGHTMETA,  MASK_META_R  },
+        { BTN_LEFT,       MASK_BUTTON1 },
+        { BTN_MIDDLE,     MASK_BUTTON2 },
+        { BTN_RIGHT,      MASK_BUTTON3 },
+        { BTN_SIDE,       MASK_BUTTON4 },
+        { BTN_EXTRA,      MASK_BUTTON5 }
+    };
 
-            // Prevent 100% CPU utilization.
-            struct timeval tv;
-            gettimeofday(&tv, NULL);
+    hook->input.mask = 0x0000;
 
-            struct timespec ts;
-            ts.tv_sec = time(NULL) + timesleep / 1000;
-            ts.tv_nsec = tv.tv_usec * 1000 + 1000 * 1000 * (timesleep % 1000);
-            ts.tv_sec += ts.tv_nsec / (1000 * 1000 * 1000);
-            ts.tv_nsec %= (1000 * 1000 * 1000);
+    unsigned int led_mask = 0x00;
+    for (size_t i = 0; i < evdev_device_count; i++) {
+        unsigned char keys[KEY_MAX / 8 + 1];
+        memset(keys, 0, sizeof(keys));
+        if (ioctl(evdev_devices[i].fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+            for (size_t j = 0; j < sizeof(modifiers) / sizeof(modifiers[0]); j++) {
+                if (keys[modifiers[j].code / 8] & (1 << (modifiers[j].code % 8))) {
+                    set_modifier_mask(modifiers[j].mask);
+                }
+            }
+        }
 
-            pthread_mutex_lock(&hook_xrecord_mutex);
-            pthread_cond_timedwait(&hook_xrecord_cond, &hook_xrecord_mutex, &ts);
-        } while (running);
+        unsigned char leds[LED_MAX / 8 + 1];
+        memset(leds, 0, sizeof(leds));
+        if (ioctl(evdev_devices[i].fd, EVIOCGLED(sizeof(leds)), leds) >= 0) {
+            if (leds[LED_CAPSL / 8] & (1 << (LED_CAPSL % 8)))     { led_mask |= 0x01; }
+            if (leds[LED_NUML / 8] & (1 << (LED_NUML % 8)))       { led_mask |= 0x02; }
+            if (leds[LED_SCROLLL / 8] & (1 << (LED_SCROLLL % 8))) { led_mask |= 0x04; }
+        }
+    }
 
-        // Unlock after loop exit.
-        pthread_mutex_unlock(&hook_xrecord_mutex);
+    #ifdef USE_XKB_COMMON
+    // Tap the lock keys that are lit so the locally compiled keymap agrees with the LEDs.
+    initialize_led_indexes();
+    if (state != NULL) {
+        if (led_mask & 0x01) {
+            xkb_state_update_key(state, KEY_CAPSLOCK + 8, XKB_KEY_DOWN);
+            xkb_state_update_key(state, KEY_CAPSLOCK + 8, XKB_KEY_UP);
+        }
 
-        // Set the exit status.
-        status = NULL;
+        if (led_mask & 0x02) {
+            xkb_state_update_key(state, KEY_NUMLOCK + 8, XKB_KEY_DOWN);
+            xkb_state_update_key(state, KEY_NUMLOCK + 8, XKB_KEY_UP);
+        }
+
+        if (led_mask & 0x04) {
+            xkb_state_update_key(state, KEY_SCROLLLOCK + 8, XKB_KEY_DOWN);
+            xkb_state_update_key(state, KEY_SCROLLLOCK + 8, XKB_KEY_UP);
+        }
     }
+    update_locks();
     #else
-    // Sync blocks until XRecordDisableContext() is called.
-    if (XRecordEnableContext(hook->data.display, hook->ctrl.context, hook_event_proc, closeure) != 0) {
-        status = UIOHOOK_SUCCESS;
-    }
+    // Ignore any indicator notifications received before this query.
+    Time led_time;
+    unsigned int indicator_mask;
+    hook->input.locks.serial = get_indicator_state(&indicator_mask, &led_time);
+    hook->input.locks.time = CurrentTime;
+
+    set_lock_mask(led_mask);
     #endif
-    else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordEnableContext failure!\n",
-            __FUNCTION__, __LINE__);
+}
 
-        #ifdef USE_XRECORD_ASYNC
-        // Reset the running state.
-        pthread_mutex_lock(&hook_xrecord_mutex);
-        running = false;
-        pthread_mutex_unlock(&hook_xrecord_mutex);
-        #endif
+/* Add the wakeup pipe and every device to the epoll set.  A device the library
+ * opened is only skipped if it cannot be watched, but a descriptor passed to
+ * hook_run_evdev() that epoll rejects, such as a regular file, fails the hook.
+ */
+static bool evdev_watch_devices(int epoll_fd, int wakeup_fd) {
+    bool status = true;
+
+    // The device index is the epoll payload, EVDEV_MAX_DEVICES is the wakeup pipe.
+    struct epoll_event watch;
+    memset(&watch, 0, sizeof(watch));
+    watch.events = EPOLLIN;
+    watch.data.u32 = EVDEV_MAX_DEVICES;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup_fd, &watch) != 0) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to watch the wakeup pipe! (%d)\n",
+                __FUNCTION__, __LINE__, errno);
+
+        status = false;
+    }
 
-        // Set the exit status.
-        status = UIOHOOK_ERROR_X_RECORD_ENABLE_CONTEXT;
+    for (size_t i = 0; i < evdev_device_count && status; i++) {
+        watch.data.u32 = (uint32_t) i;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, evdev_devices[i].fd, &watch) != 0) {
+            if (evdev_devices[i].owned) {
+                logger(LOG_LEVEL_WARN, "%s [%u]: Failed to watch file descriptor %d! (%d)\n",
+                        __FUNCTION__, __LINE__, evdev_devices[i].fd, errno);
+            } else {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: File descriptor %d cannot be polled! (%d)\n",
+                        __FUNCTION__, __LINE__, evdev_devices[i].fd, errno);
+
+                status = false;
+            }
+        }
     }
 
     return status;
 }
 
-static int xrecord_alloc() {
+static int evdev_block() {
     int status = UIOHOOK_FAILURE;
 
-    // Make sure the data display is synchronized to prevent late event delivery!
-    // See Bug 42356 for more information.
-    // https://bugs.freedesktop.org/show_bug.cgi?id=42356#c4
-    XSynchronize(hook->data.display, True);
-
-    // Setup XRecord range.
-    XRecordClientSpec clients = XRecordAllClients;
-
-    hook->data.range = XRecordAllocRange();
-    if (hook->data.range != NULL) {
-        logger(LOG_LEVEL_DEBUG, "%s [%u]: XRecordAllocRange successful.\n",
-                __FUNCTION__, __LINE__);
+    int wakeup_fds[2] = { -1, -1 };
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to create epoll instance! (%d)\n",
+                __FUNCTION__, __LINE__, errno);
+    } else if (pipe(wakeup_fds) != 0) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to create wakeup pipe! (%d)\n",
+                __FUNCTION__, __LINE__, errno);
+    } else if (evdev_watch_devices(epoll_fd, wakeup_fds[0])) {
+        pthread_mutex_lock(&hook_control_mutex);
+        evdev_wakeup_fd = wakeup_fds[1];
+        pthread_mutex_unlock(&hook_control_mutex);
+
+        dispatch_hook_state(EVENT_HOOK_ENABLED, evdev_now());
+        flush_dispatch_batch();
+
+        struct epoll_event ready[EVDEV_MAX_DEVICES + 1];
+        bool running = true;
+        while (running) {
+            int count = epoll_wait(epoll_fd, ready, EVDEV_MAX_DEVICES + 1, -1);
+            if (count < 0 && errno != EINTR) {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to wait for input devices! (%d)\n",
+                        __FUNCTION__, __LINE__, errno);
+
+                running = false;
+            }
 
-        hook->data.range->device_events.first = KeyPress;
-        hook->data.range->device_events.last = MotionNotify;
+            for (int i = 0; i < count; i++) {
+                uint32_t index = ready[i].data.u32;
+                if (index == EVDEV_MAX_DEVICES) {
+                    running = false;
+                } else if (!evdev_read(&evdev_devices[index])) {
+                    // Unplugged device or closed FIFO, it cannot come back.
+                    logger(LOG_LEVEL_DEBUG, "%s [%u]: File descriptor %d closed.\n",
+                            __FUNCTION__, __LINE__, evdev_devices[index].fd);
+
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, evdev_devices[index].fd, NULL);
+                    if (evdev_devices[index].owned) {
+                        close(evdev_devices[index].fd);
+                    }
+                    evdev_devices[index].fd = -1;
+                }
+            }
 
-        // Note that the documentation for this function is incorrect,
-        // hook->data.display should be used!
-        // See: http://www.x.org/releases/X11R7.6/doc/libXtst/recordlib.txt
-        hook->ctrl.context = XRecordCreateContext(hook->data.display, XRecordFromServerTime, &clients, 1, &hook->data.range, 1);
-        if (hook->ctrl.context != 0) {
-            logger(LOG_LEVEL_DEBUG, "%s [%u]: XRecordCreateContext successful.\n",
-                    __FUNCTION__, __LINE__);
+            // Deliver everything read for this wakeup as one batch.
+            flush_dispatch_batch();
+        }
 
-            // Block until hook_stop() is called.
-            status = xrecord_block();
+        pthread_mutex_lock(&hook_control_mutex);
+        evdev_wakeup_fd = -1;
+        pthread_mutex_unlock(&hook_control_mutex);
 
-            // Free up the context if it was set.
-            XRecordFreeContext(hook->data.display, hook->ctrl.context);
-        } else {
-            logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordCreateContext failure!\n",
-                    __FUNCTION__, __LINE__);
+        dispatch_hook_state(EVENT_HOOK_DISABLED, evdev_now());
+        flush_dispatch_batch();
 
-            // Set the exit status.
-            status = UIOHOOK_ERROR_X_RECORD_CREATE_CONTEXT;
-        }
+        status = UIOHOOK_SUCCESS;
+    }
 
-        // Free the XRecord range.
-        XFree(hook->data.range);
-    } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordAllocRange failure!\n",
-                __FUNCTION__, __LINE__);
+    if (wakeup_fds[0] != -1) {
+        close(wakeup_fds[0]);
+        close(wakeup_fds[1]);
+    }
 
-        // Set the exit status.
-        status = UIOHOOK_ERROR_X_RECORD_ALLOC_RANGE;
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
     }
 
     return status;
 }
 
-static int xrecord_query() {
+// Wake evdev_block() out of epoll_wait().
+static int evdev_stop() {
     int status = UIOHOOK_FAILURE;
 
-    // Check to make sure XRecord is installed and enabled.
-    int major, minor;
-    if (XRecordQueryVersion(hook->ctrl.display, &major, &minor) != 0) {
-        logger(LOG_LEVEL_INFO, "%s [%u]: XRecord version: %i.%i.\n",
-                __FUNCTION__, __LINE__, major, minor);
-
-        status = xrecord_alloc();
-    } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: XRecord is not currently available!\n",
-                __FUNCTION__, __LINE__);
-
-        status = UIOHOOK_ERROR_X_RECORD_NOT_FOUND;
+    pthread_mutex_lock(&hook_control_mutex);
+    if (evdev_wakeup_fd != -1) {
+        char wakeup = 0x00;
+        if (write(evdev_wakeup_fd, &wakeup, 1) == 1) {
+            status = UIOHOOK_SUCCESS;
+        } else {
+            logger(LOG_LEVEL_WARN, "%s [%u]: Failed to wake the hook thread! (%d)\n",
+                    __FUNCTION__, __LINE__, errno);
+        }
     }
+    pthread_mutex_unlock(&hook_control_mutex);
 
     return status;
 }
 
-static int xrecord_start() {
+// Run the hook on evdev devices, or on the given descriptors carrying input_event records.
+static int evdev_start(const int *fds, size_t count) {
     int status = UIOHOOK_FAILURE;
 
-    // Open the control display for XRecord.
-    hook->ctrl.display = XOpenDisplay(NULL);
+    evdev_device_count = 0;
+    if (fds != NULL) {
+        for (size_t i = 0; i < count && evdev_device_count < EVDEV_MAX_DEVICES; i++) {
+            evdev_add_device(fds[i], false);
+        }
+    } else {
+        evdev_open_devices();
+    }
 
-    // Open a data display for XRecord.
-    // NOTE This display must be opened on the same thread as XRecord.
-    hook->data.display = XOpenDisplay(NULL);
-    if (hook->ctrl.display != NULL && hook->data.display != NULL) {
-        logger(LOG_LEVEL_DEBUG, "%s [%u]: XOpenDisplay successful.\n",
-                __FUNCTION__, __LINE__);
+    if (evdev_device_count > 0) {
+        key_descriptors = get_evdev_key_descriptors();
+
+        // Scale absolute devices to the screens if any are known.
+        evdev_width = 0;
+        evdev_height = 0;
+        unsigned char screen_count = 0;
+        screen_data *screens = hook_create_screen_info(&screen_count);
+        if (screens != NULL) {
+            for (unsigned char i = 0; i < screen_count; i++) {
+                if (screens[i].x + screens[i].width > evdev_width) {
+                    evdev_width = screens[i].x + screens[i].width;
+                }
 
-        bool is_auto_repeat = enable_key_repeate();
-        if (is_auto_repeat) {
-            logger(LOG_LEVEL_DEBUG, "%s [%u]: Successfully enabled detectable auto-repeat.\n",
-                    __FUNCTION__, __LINE__);
-        } else {
-            logger(LOG_LEVEL_WARN, "%s [%u]: Could not enable detectable auto-repeat!\n",
-                    __FUNCTION__, __LINE__);
+                if (screens[i].y + screens[i].height > evdev_height) {
+                    evdev_height = screens[i].y + screens[i].height;
+                }
+            }
+
+            free(screens);
         }
 
-        #if defined(USE_XKB_COMMON)
-        // Open XCB Connection
-        hook->input.connection = XGetXCBConnection(hook->ctrl.display);
-        int xcb_status = xcb_connection_has_error(hook->input.connection);
-        if (xcb_status <= 0) {
-            // Initialize xkbcommon context.
-            struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+        evdev_x = 0;
+        evdev_y = 0;
+        evdev_delta_x = 0;
+        evdev_delta_y = 0;
+        evdev_moved = false;
 
-            if (context != NULL) {
-                hook->input.context = xkb_context_ref(context);
+        #ifdef USE_XKB_COMMON
+        // There may be no X server, compile the keymap from the XKB_DEFAULT_* environment.
+        hook->input.context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+        if (hook->input.context != NULL) {
+            struct xkb_keymap *keymap = xkb_keymap_new_from_names(hook->input.context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+            if (keymap != NULL) {
+                state = xkb_state_new(keymap);
+                xkb_keymap_unref(keymap);
             } else {
-                logger(LOG_LEVEL_ERROR, "%s [%u]: xkb_context_new failure!\n",
+                logger(LOG_LEVEL_WARN, "%s [%u]: xkb_keymap_new_from_names failure!\n",
                         __FUNCTION__, __LINE__);
             }
         } else {
-            logger(LOG_LEVEL_ERROR, "%s [%u]: xcb_connect failure! (%d)\n",
-                    __FUNCTION__, __LINE__, xcb_status);
+            logger(LOG_LEVEL_ERROR, "%s [%u]: xkb_context_new failure!\n",
+                    __FUNCTION__, __LINE__);
         }
         #endif
 
-        #ifdef USE_XKB_COMMON
-        state = create_xkb_state(hook->input.context, hook->input.connection);
-        #endif
-
-        // Initialize starting modifiers.
-        initialize_modifiers();
+        evdev_initialize_modifiers();
 
-        status = xrecord_query();
+        // Block until hook_stop() is called.
+        status = evdev_block();
 
         #ifdef USE_XKB_COMMON
         if (state != NULL) {
             destroy_xkb_state(state);
+            state = NULL;
         }
 
         if (hook->input.context != NULL) {
@@ -1008,62 +3029,262 @@ static int xrecord_start() {
             hook->input.context = NULL;
         }
         #endif
+
+        key_descriptors = get_key_descriptors();
     } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: XOpenDisplay failure!\n",
+        logger(LOG_LEVEL_ERROR, "%s [%u]: No input devices are available!\n",
                 __FUNCTION__, __LINE__);
-
-        status = UIOHOOK_ERROR_X_OPEN_DISPLAY;
     }
 
-    // Close down the XRecord data display.
-    if (hook->data.display != NULL) {
-        XCloseDisplay(hook->data.display);
-        hook->data.display = NULL;
-    }
-
-    // Close down the XRecord control display.
-    if (hook->ctrl.display) {
-        XCloseDisplay(hook->ctrl.display);
-        hook->ctrl.display = NULL;
+    for (size_t i = 0; i < evdev_device_count; i++) {
+        if (evdev_devices[i].owned && evdev_devices[i].fd != -1) {
+            close(evdev_devices[i].fd);
+        }
     }
+    evdev_device_count = 0;
 
     return status;
 }
+#endif
 
-UIOHOOK_API int hook_run() {
+// Allocate the hook structure and start dispatching.
+static int hook_create() {
     int status = UIOHOOK_FAILURE;
 
     // Hook data for future cleanup.
+    pthread_mutex_lock(&hook_control_mutex);
     hook = malloc(sizeof(hook_info));
     if (hook != NULL) {
+        hook->data.display = NULL;
+        hook->data.range = NULL;
+        hook->data.enabled = false;
+        hook->ctrl.display = NULL;
+        hook->ctrl.context = 0;
+        #ifdef USE_XKB_COMMON
+        hook->input.connection = NULL;
+        hook->input.context = NULL;
+        #endif
         hook->input.mask = 0x0000;
         hook->input.mouse.is_dragged = false;
+        hook->input.mouse.delta_x = 0;
+        hook->input.mouse.delta_y = 0;
         hook->input.mouse.click.count = 0;
         hook->input.mouse.click.time = 0;
         hook->input.mouse.click.button = MOUSE_NOBUTTON;
+        pthread_mutex_unlock(&hook_control_mutex);
 
-        status = xrecord_start();
+        key_descriptors = get_key_descriptors();
+        load_button_descriptors();
 
-        // Free data associated with this hook.
-        free(hook);
-        hook = NULL;
+        status = start_dispatch_thread();
+        if (status != UIOHOOK_SUCCESS) {
+            pthread_mutex_lock(&hook_control_mutex);
+            free(hook);
+            hook = NULL;
+            pthread_mutex_unlock(&hook_control_mutex);
+        }
     } else {
+        pthread_mutex_unlock(&hook_control_mutex);
+
         logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for hook structure!\n",
                 __FUNCTION__, __LINE__);
 
         status = UIOHOOK_ERROR_OUT_OF_MEMORY;
     }
 
+    return status;
+}
+
+// Stop dispatching and free the hook structure.
+static void hook_destroy() {
+    // Deliver anything left in the ring before returning.
+    stop_dispatch_thread();
+
+    // Nothing is dispatching now, free any retired subscriber lists.
+    pthread_mutex_lock(&subscribers_mutex);
+    reclaim_subscribers();
+    pthread_mutex_unlock(&subscribers_mutex);
+
+    // Free data associated with this hook.
+    pthread_mutex_lock(&hook_control_mutex);
+    free(hook);
+    hook = NULL;
+    pthread_mutex_unlock(&hook_control_mutex);
+}
+
+UIOHOOK_API int hook_run() {
+    int status = hook_create();
+    if (status == UIOHOOK_SUCCESS) {
+        #ifdef USE_XINPUT2
+        status = xinput_start();
+        if (status == UIOHOOK_FAILURE) {
+            logger(LOG_LEVEL_INFO, "%s [%u]: Falling back to XRecord.\n",
+                    __FUNCTION__, __LINE__);
+
+            status = xrecord_start();
+        }
+        #else
+        status = xrecord_start();
+        #endif
+
+        hook_destroy();
+    }
+
+    logger(LOG_LEVEL_DEBUG, "%s [%u]: Something, something, something, complete.\n",
+            __FUNCTION__, __LINE__);
+
+    return status;
+}
+
+#ifdef USE_EVDEV
+UIOHOOK_API int hook_run_evdev(const int *fds, size_t count) {
+    int status = hook_create();
+    if (status == UIOHOOK_SUCCESS) {
+        status = evdev_start(fds, count);
+
+        hook_destroy();
+    }
+
     logger(LOG_LEVEL_DEBUG, "%s [%u]: Something, something, something, complete.\n",
             __FUNCTION__, __LINE__);
 
     return status;
 }
+#else
+UIOHOOK_API int hook_run_evdev(const int *fds, size_t count) {
+    logger(LOG_LEVEL_WARN, "%s [%u]: Built without evdev support, USE_EVDEV is not set!\n",
+            __FUNCTION__, __LINE__);
+
+    return UIOHOOK_FAILURE;
+}
+#endif
+
+UIOHOOK_API int hook_start_nonblocking(int *fd) {
+    int status = UIOHOOK_FAILURE;
+
+    if (hook != NULL) {
+        logger(LOG_LEVEL_WARN, "%s [%u]: The hook is already running!\n",
+                __FUNCTION__, __LINE__);
+    } else if (fd != NULL) {
+        status = hook_create();
+        if (status == UIOHOOK_SUCCESS) {
+            status = xrecord_open();
+            if (status == UIOHOOK_SUCCESS) {
+                status = xrecord_query();
+            }
+
+            if (status == UIOHOOK_SUCCESS) {
+                status = xrecord_alloc();
+            }
+
+            if (status == UIOHOOK_SUCCESS) {
+                // The replies are read by hook_process_pending() when the caller sees fd is readable.
+                if (XRecordEnableContextAsync(hook->data.display, hook->ctrl.context, hook_event_proc, NULL) != 0) {
+                    *fd = ConnectionNumber(hook->data.display);
+                    nonblocking = true;
+
+                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Polling XRecord data on file descriptor %d.\n",
+                            __FUNCTION__, __LINE__, *fd);
+                } else {
+                    logger(LOG_LEVEL_ERROR, "%s [%u]: XRecordEnableContextAsync failure!\n",
+                            __FUNCTION__, __LINE__);
+
+                    xrecord_free();
+                    status = UIOHOOK_ERROR_X_RECORD_ENABLE_CONTEXT;
+                }
+            }
+
+            if (status != UIOHOOK_SUCCESS) {
+                xrecord_close();
+                hook_destroy();
+            }
+        }
+    }
+
+    return status;
+}
+
+// Disable the context and deliver the remaining data, then tear down the hook
+// started by hook_start_nonblocking().
+static int hook_stop_nonblocking() {
+    int status = UIOHOOK_FAILURE;
+
+    // A dispatcher calling hook_stop() for the events drained below is ignored.
+    processing_pending = true;
+    stop_requested = false;
+
+    if (XRecordDisableContext(hook->ctrl.display, hook->ctrl.context) != 0) {
+        XSync(hook->ctrl.display, False);
+
+        // The server does not handle requests on the data display while the context is
+        // enabled, so this round trip returns after the last reply, XRecordEndOfData,
+        // has been passed to hook_event_proc().
+        XSync(hook->data.display, False);
+        flush_dispatch_batch();
+
+        if (hook->data.enabled) {
+            logger(LOG_LEVEL_WARN, "%s [%u]: XRecord end of data was not received!\n",
+                    __FUNCTION__, __LINE__);
+        }
+
+        status = UIOHOOK_SUCCESS;
+    }
+
+    xrecord_free();
+    xrecord_close();
+    hook_destroy();
+
+    nonblocking = false;
+    processing_pending = false;
+    stop_requested = false;
+
+    return status;
+}
+
+UIOHOOK_API int hook_process_pending() {
+    int status = UIOHOOK_FAILURE;
+
+    if (nonblocking && hook != NULL && !processing_pending) {
+        // Read whatever has arrived on the data display without blocking.
+        processing_pending = true;
+        XRecordProcessReplies(hook->data.display);
+        flush_dispatch_batch();
+        processing_pending = false;
+
+        status = UIOHOOK_SUCCESS;
+
+        // The hook cannot be torn down while XRecordProcessReplies() is still using it.
+        if (stop_requested) {
+            status = hook_stop_nonblocking();
+        }
+    }
+
+    return status;
+}
 
 UIOHOOK_API int hook_stop() {
     int status = UIOHOOK_FAILURE;
 
-    if (hook != NULL && hook->ctrl.display != NULL && hook->ctrl.context != 0) {
+    if (nonblocking && hook != NULL) {
+        if (processing_pending) {
+            // Called from a dispatcher, hook_process_pending() stops the hook before it returns.
+            stop_requested = true;
+            status = UIOHOOK_SUCCESS;
+        } else {
+            status = hook_stop_nonblocking();
+        }
+    }
+    #ifdef USE_XINPUT2
+    else if (xinput_window != None) {
+        status = xinput_stop();
+    }
+    #endif
+    #ifdef USE_EVDEV
+    else if (evdev_wakeup_fd != -1) {
+        status = evdev_stop();
+    }
+    #endif
+    else if (hook != NULL && hook->ctrl.display != NULL && hook->ctrl.context != 0) {
         // We need to make sure the context is still valid.
         XRecordState *state = malloc(sizeof(XRecordState));
         if (state != NULL) {
@@ -1073,7 +3294,14 @@ UIOHOOK_API int hook_stop() {
                     #ifdef USE_XRECORD_ASYNC
                     pthread_mutex_lock(&hook_xrecord_mutex);
                     running = false;
-                    pthread_cond_signal(&hook_xrecord_cond);
+                    if (hook_wakeup_fd != -1) {
+                        // Wake xrecord_block() from poll(), the byte is never read.
+                        char wakeup = 0x00;
+                        if (write(hook_wakeup_fd, &wakeup, 1) != 1) {
+                            logger(LOG_LEVEL_WARN, "%s [%u]: Failed to wake the hook thread! (%d)\n",
+                                    __FUNCTION__, __LINE__, errno);
+                        }
+                    }
                     pthread_mutex_unlock(&hook_xrecord_mutex);
                     #endif
 
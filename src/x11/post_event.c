@@ -16,23 +16,73 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <uiohook.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #ifdef USE_XTEST
 #include <X11/extensions/XTest.h>
+#include <X11/keysym.h>
+#include <X11/XKBlib.h>
 #endif
 
 #include "input_helper.h"
 #include "logger.h"
 
-extern Display *properties_disp;
+/* Posting has its own connection so it never waits on the property getters
+ * for the properties_disp lock.  It is opened with the posting thread on the
+ * first post and closed by on_library_unload().
+ */
+static Display *post_disp = NULL;
+
+/* A submission to the posting thread.  Queued requests own a copy of their
+ * events and are freed by the posting thread, while waiting requests live on
+ * the submitter's stack until done is posted.
+ */
+typedef struct _post_request {
+    struct _post_request *next;
+    uiohook_event *events;
+    size_t count;
+    uint8_t flags;
+    bool is_stop;
+    sem_t *done;
+} post_request;
+
+/* Intrusive multi-producer, single-consumer queue.  Producers only swap the
+ * head and link the previous node, so submitting never blocks and requests
+ * from one thread keep their order.  Only the posting thread touches the tail.
+ */
+static post_request post_queue_stub = { .next = NULL };
+static post_request *post_queue_head = &post_queue_stub;
+static post_request *post_queue_tail = &post_queue_stub;
+static sem_t post_queue_sem;
+
+// Posting thread, started on demand because most hook users never post.
+static pthread_mutex_t post_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t post_thread_id;
+static bool post_thread_running = false;
+
+// Most requests the posting thread drains under one display lock.
+#define POST_DRAIN_MAX 64
+
+#if !defined(USE_XTEST) && (defined(USE_XINERAMA) || defined(USE_XRANDR))
+// Cached screen origin provided by system_properties.c.
+extern bool get_screen_origin(int16_t *x, int16_t *y);
+#endif
 
-// This lookup table must be in the same order the masks are defined.
 #ifdef USE_XTEST
+// Keyboard mapping serial bumped by the settings thread in system_properties.c.
+extern unsigned long get_keyboard_map_serial();
+
+// This lookup table must be in the same order the masks are defined.
 static KeySym keymask_lookup[8] = {
     XK_Shift_L,
     XK_Control_L,
@@ -52,6 +102,119 @@ static unsigned int btnmask_lookup[5] = {
     MASK_BUTTON4,
     MASK_BUTTON5
 };
+
+// X11 buttons for MOUSE_BUTTON1 through MOUSE_BUTTON5, the same mapping the hook reports.
+static unsigned int btnmask_native[5] = {
+    Button1,
+    Button2,
+    Button3,
+    XButton1,
+    XButton2
+};
+
+// Key codes for keymask_lookup, refreshed when the keyboard mapping serial changes.
+static KeyCode keymask_keycodes[8];
+static unsigned long keymask_serial = 0;
+static bool keymask_valid = false;
+
+/* Modifier keys and buttons the poster is holding down, and the subset it
+ * pressed to fake an event mask.  Both are guarded by the post_disp lock.
+ */
+static uint16_t held_mask = 0x0000;
+static uint16_t synthetic_mask = 0x0000;
+
+static void load_keymask_keycodes() {
+    unsigned long serial = get_keyboard_map_serial();
+    if (!keymask_valid || serial != keymask_serial) {
+        if (keymask_valid) {
+            // This connection never receives MappingNotify, refresh Xlib's keysym cache by hand.
+            int min_keycode, max_keycode;
+            XDisplayKeycodes(post_disp, &min_keycode, &max_keycode);
+
+            XMappingEvent mapping = {
+                .type = MappingNotify,
+                .display = post_disp,
+                .request = MappingKeyboard,
+                .first_keycode = min_keycode,
+                .count = max_keycode - min_keycode + 1
+            };
+            XRefreshKeyboardMapping(&mapping);
+        }
+
+        for (unsigned int i = 0; i < sizeof(keymask_lookup) / sizeof(KeySym); i++) {
+            keymask_keycodes[i] = XKeysymToKeycode(post_disp, keymask_lookup[i]);
+        }
+
+        keymask_serial = serial;
+        keymask_valid = true;
+    }
+}
+
+static unsigned int button_to_native(unsigned int button) {
+    if (button >= MOUSE_BUTTON1 && button <= MOUSE_BUTTON5) {
+        button = btnmask_native[button - MOUSE_BUTTON1];
+    }
+
+    return button;
+}
+
+// The mask bit of the modifier key or button the event itself presses or releases.
+static uint16_t get_event_mask(uiohook_event * const event) {
+    uint16_t mask = 0x0000;
+
+    if (event->type == EVENT_KEY_PRESSED || event->type == EVENT_KEY_RELEASED) {
+        KeyCode keycode = scancode_to_keycode(event->data.keyboard.keycode);
+        for (unsigned int i = 0; i < sizeof(keymask_keycodes) / sizeof(KeyCode); i++) {
+            if (keycode != 0 && keymask_keycodes[i] == keycode) {
+                mask = 1 << i;
+            }
+        }
+    } else if (event->type == EVENT_MOUSE_PRESSED || event->type == EVENT_MOUSE_RELEASED || event->type == EVENT_MOUSE_CLICKED) {
+        if (event->data.mouse.button >= MOUSE_BUTTON1 && event->data.mouse.button <= MOUSE_BUTTON5) {
+            mask = btnmask_lookup[event->data.mouse.button - MOUSE_BUTTON1];
+        }
+    }
+
+    return mask;
+}
+
+/* XTest does not have modifier support, so we fake it by depressing the
+ * appropriate modifier keys and buttons.  Only the difference from what is
+ * already held is sent, so a run of events with the same mask presses each
+ * modifier once.  Keys and buttons pressed by posted events, and the ones in
+ * exclude that the next event posts itself, are left alone.
+ */
+static void post_mask_delta(uint16_t mask, uint16_t exclude) {
+    uint16_t press = mask & ~held_mask & ~exclude;
+    uint16_t release = synthetic_mask & ~mask & ~exclude;
+
+    for (unsigned int i = 0; i < sizeof(keymask_lookup) / sizeof(KeySym); i++) {
+        if (release & 1 << i && keymask_keycodes[i] != 0) {
+            XTestFakeKeyEvent(post_disp, keymask_keycodes[i], False, 0);
+        }
+    }
+
+    for (unsigned int i = 0; i < sizeof(btnmask_lookup) / sizeof(unsigned int); i++) {
+        if (release & btnmask_lookup[i]) {
+            XTestFakeButtonEvent(post_disp, btnmask_native[i], False, 0);
+        }
+    }
+
+    for (unsigned int i = 0; i < sizeof(keymask_lookup) / sizeof(KeySym); i++) {
+        if (press & 1 << i && keymask_keycodes[i] != 0) {
+            XTestFakeKeyEvent(post_disp, keymask_keycodes[i], True, 0);
+        }
+    }
+
+    for (unsigned int i = 0; i < sizeof(btnmask_lookup) / sizeof(unsigned int); i++) {
+        if (press & btnmask_lookup[i]) {
+            XTestFakeButtonEvent(post_disp, btnmask_native[i], True, 0);
+        }
+    }
+
+    held_mask = (held_mask & ~release) | press;
+    synthetic_mask = (synthetic_mask & ~release) | press;
+}
 #else
 // TODO Possibly relocate to input helper.
 static unsigned int convert_to_native_mask(unsigned int mask) {
@@ -77,13 +240,13 @@ static inline void post_key_event(uiohook_event * const event) {
     // FIXME Currently ignoring EVENT_KEY_TYPED.
     if (event->type == EVENT_KEY_PRESSED) {
         XTestFakeKeyEvent(
-            properties_disp,
+            post_disp,
             scancode_to_keycode(event->data.keyboard.keycode),
             True,
             0);
     } else if (event->type == EVENT_KEY_RELEASED) {
         XTestFakeKeyEvent(
-            properties_disp,
+            post_disp,
             scancode_to_keycode(event->data.keyboard.keycode),
             False,
             0);
@@ -93,13 +256,13 @@ static inline void post_key_event(uiohook_event * const event) {
 
     key_event.serial = 0x00;
     key_event.send_event = False;
-    key_event.display = properties_disp;
+    key_event.display = post_disp;
     key_event.time = CurrentTime;
     key_event.same_screen = True;
 
     unsigned int mask;
-    if (!XQueryPointer(properties_disp, DefaultRootWindow(properties_disp), &(key_event.root), &(key_event.subwindow), &(key_event.x_root), &(key_event.y_root), &(key_event.x), &(key_event.y), &mask)) {
-        key_event.root = DefaultRootWindow(properties_disp);
+    if (!XQueryPointer(post_disp, DefaultRootWindow(post_disp), &(key_event.root), &(key_event.subwindow), &(key_event.x_root), &(key_event.y_root), &(key_event.x), &(key_event.y), &mask)) {
+        key_event.root = DefaultRootWindow(post_disp);
         key_event.window = key_event.root;
         key_event.subwindow = None;
 
@@ -110,15 +273,15 @@ static inline void post_key_event(uiohook_event * const event) {
     }
 
     key_event.state = convert_to_native_mask(event->mask);
-    key_event.keycode = XKeysymToKeycode(properties_disp, scancode_to_keycode(event->data.keyboard.keycode));
+    key_event.keycode = XKeysymToKeycode(post_disp, scancode_to_keycode(event->data.keyboard.keycode));
 
     // FIXME Currently ignoring typed events.
     if (event->type == EVENT_KEY_PRESSED) {
         key_event.type = KeyPress;
-        XSendEvent(properties_disp, InputFocus, False, KeyPressMask, (XEvent *) &key_event);
+        XSendEvent(post_disp, InputFocus, False, KeyPressMask, (XEvent *) &key_event);
     } else if (event->type == EVENT_KEY_RELEASED) {
         key_event.type = KeyRelease;
-        XSendEvent(properties_disp, InputFocus, False, KeyReleaseMask, (XEvent *) &key_event);
+        XSendEvent(post_disp, InputFocus, False, KeyReleaseMask, (XEvent *) &key_event);
     }
     #endif
 }
@@ -133,12 +296,12 @@ static inline void post_mouse_button_event(uiohook_event * const event) {
     int win_y;
     unsigned int mask;
 
-    Window win_root = XDefaultRootWindow(properties_disp);
-    Bool query_status = XQueryPointer(properties_disp, win_root, &ret_root, &ret_child, &root_x, &root_y, &win_x, &win_y, &mask);
+    Window win_root = XDefaultRootWindow(post_disp);
+    Bool query_status = XQueryPointer(post_disp, win_root, &ret_root, &ret_child, &root_x, &root_y, &win_x, &win_y, &mask);
     if (query_status) {
         if (event->data.mouse.x != root_x || event->data.mouse.y != root_y) {
             // Move the pointer to the specified position.
-            XTestFakeMotionEvent(properties_disp, -1, event->data.mouse.x, event->data.mouse.y, 0);
+            XTestFakeMotionEvent(post_disp, -1, event->data.mouse.x, event->data.mouse.y, 0);
         } else {
             query_status = False;
         }
@@ -148,35 +311,35 @@ static inline void post_mouse_button_event(uiohook_event * const event) {
         // Wheel events should be the same as click events on X11.
         // type, amount and rotation
         if (event->data.wheel.rotation < 0) {
-            XTestFakeButtonEvent(properties_disp, WheelUp, True, 0);
-            XTestFakeButtonEvent(properties_disp, WheelUp, False, 0);
+            XTestFakeButtonEvent(post_disp, WheelUp, True, 0);
+            XTestFakeButtonEvent(post_disp, WheelUp, False, 0);
         } else {
-            XTestFakeButtonEvent(properties_disp, WheelDown, True, 0);
-            XTestFakeButtonEvent(properties_disp, WheelDown, False, 0);
+            XTestFakeButtonEvent(post_disp, WheelDown, True, 0);
+            XTestFakeButtonEvent(post_disp, WheelDown, False, 0);
         }
     } else if (event->type == EVENT_MOUSE_PRESSED) {
-        XTestFakeButtonEvent(properties_disp, event->data.mouse.button, True, 0);
+        XTestFakeButtonEvent(post_disp, button_to_native(event->data.mouse.button), True, 0);
     } else if (event->type == EVENT_MOUSE_RELEASED) {
-        XTestFakeButtonEvent(properties_disp, event->data.mouse.button, False, 0);
+        XTestFakeButtonEvent(post_disp, button_to_native(event->data.mouse.button), False, 0);
     } else if (event->type == EVENT_MOUSE_CLICKED) {
-        XTestFakeButtonEvent(properties_disp, event->data.mouse.button, True, 0);
-        XTestFakeButtonEvent(properties_disp, event->data.mouse.button, False, 0);
+        XTestFakeButtonEvent(post_disp, button_to_native(event->data.mouse.button), True, 0);
+        XTestFakeButtonEvent(post_disp, button_to_native(event->data.mouse.button), False, 0);
     }
 
     if (query_status) {
         // Move the pointer back to the original position.
-        XTestFakeMotionEvent(properties_disp, -1, root_x, root_y, 0);
+        XTestFakeMotionEvent(post_disp, -1, root_x, root_y, 0);
     }
     #else
     XButtonEvent btn_event;
 
     btn_event.serial = 0x00;
     btn_event.send_event = False;
-    btn_event.display = properties_disp;
+    btn_event.display = post_disp;
     btn_event.time = CurrentTime;
     btn_event.same_screen = True;
 
-    btn_event.root = DefaultRootWindow(properties_disp);
+    btn_event.root = DefaultRootWindow(post_disp);
     btn_event.window = btn_event.root;
     btn_event.subwindow = None;
 
@@ -194,15 +357,10 @@ static inline void post_mouse_button_event(uiohook_event * const event) {
     btn_event.y = event->data.mouse.y;
 
     #if defined(USE_XINERAMA) || defined(USE_XRANDR)
-    uint8_t screen_count;
-    screen_data *screens = hook_create_screen_info(&screen_count);
-    if (screen_count > 1) {
-        btn_event.x += screens[0].x;
-        btn_event.y += screens[0].y;
-    }
-
-    if (screens != NULL) {
-        free(screens);
+    int16_t screen_x, screen_y;
+    if (get_screen_origin(&screen_x, &screen_y)) {
+        btn_event.x += screen_x;
+        btn_event.y += screen_y;
     }
     #endif
 
@@ -222,29 +380,29 @@ static inline void post_mouse_button_event(uiohook_event * const event) {
     if (event->type != EVENT_MOUSE_RELEASED) {
         // FIXME Where do we set event->button?
         btn_event.type = ButtonPress;
-        XSendEvent(properties_disp, InputFocus, False, ButtonPressMask, (XEvent *) &btn_event);
+        XSendEvent(post_disp, InputFocus, False, ButtonPressMask, (XEvent *) &btn_event);
     }
 
     if (event->type != EVENT_MOUSE_PRESSED) {
         btn_event.type = ButtonRelease;
-        XSendEvent(properties_disp, InputFocus, False, ButtonReleaseMask, (XEvent *) &btn_event);
+        XSendEvent(post_disp, InputFocus, False, ButtonReleaseMask, (XEvent *) &btn_event);
     }
     #endif
 }
 
 static inline void post_mouse_motion_event(uiohook_event * const event) {
     #ifdef USE_XTEST
-    XTestFakeMotionEvent(properties_disp, -1, event->data.mouse.x, event->data.mouse.y, 0);
+    XTestFakeMotionEvent(post_disp, -1, event->data.mouse.x, event->data.mouse.y, 0);
     #else
     XMotionEvent mov_event;
 
     mov_event.serial = MotionNotify;
     mov_event.send_event = False;
-    mov_event.display = properties_disp;
+    mov_event.display = post_disp;
     mov_event.time = CurrentTime;
     mov_event.same_screen = True;
     mov_event.is_hint = NotifyNormal,
-    mov_event.root = DefaultRootWindow(properties_disp);
+    mov_event.root = DefaultRootWindow(post_disp);
     mov_event.window = mov_event.root;
     mov_event.subwindow = None;
 
@@ -261,15 +419,10 @@ static inline void post_mouse_motion_event(uiohook_event * const event) {
     mov_event.y = event->data.mouse.y;
 
     #if defined(USE_XINERAMA) || defined(USE_XRANDR)
-    uint8_t screen_count;
-    screen_data *screens = hook_create_screen_info(&screen_count);
-    if (screen_count > 1) {
-        mov_event.x += screens[0].x;
-        mov_event.y += screens[0].y;
-    }
-
-    if (screens != NULL) {
-        free(screens);
+    int16_t screen_x, screen_y;
+    if (get_screen_origin(&screen_x, &screen_y)) {
+        mov_event.x += screen_x;
+        mov_event.y += screen_y;
     }
     #endif
 
@@ -314,27 +467,15 @@ static inline void post_mouse_motion_event(uiohook_event * const event) {
     }
 
     // NOTE x_mask = NoEventMask.
-    XSendEvent(properties_disp, InputFocus, False, event_mask, (XEvent *) &mov_event);
+    XSendEvent(post_disp, InputFocus, False, event_mask, (XEvent *) &mov_event);
     #endif
 }
 
-UIOHOOK_API void hook_post_event(uiohook_event * const event) {
-    XLockDisplay(properties_disp);
-
+static void post_event(uiohook_event * const event) {
     #ifdef USE_XTEST
-    // XTest does not have modifier support, so we fake it by depressing the
-    // appropriate modifier keys.
-    for (unsigned int i = 0; i < sizeof(keymask_lookup) / sizeof(KeySym); i++) {
-        if (event->mask & 1 << i) {
-            XTestFakeKeyEvent(properties_disp, XKeysymToKeycode(properties_disp, keymask_lookup[i]), True, 0);
-        }
-    }
-
-    for (unsigned int i = 0; i < sizeof(btnmask_lookup) / sizeof(unsigned int); i++) {
-        if (event->mask & btnmask_lookup[i]) {
-            XTestFakeButtonEvent(properties_disp, i + 1, True, 0);
-        }
-    }
+    // The event's own key or button is posted below, not faked from the mask.
+    uint16_t event_mask = get_event_mask(event);
+    post_mask_delta(event->mask, event_mask);
     #endif
 
     switch (event->type) {
@@ -368,21 +509,1110 @@ UIOHOOK_API void hook_post_event(uiohook_event * const event) {
     }
 
     #ifdef USE_XTEST
-    // Release the previously held modifier keys used to fake the event mask.
-    for (unsigned int i = 0; i < sizeof(keymask_lookup) / sizeof(KeySym); i++) {
-        if (event->mask & 1 << i) {
-            XTestFakeKeyEvent(properties_disp, XKeysymToKeycode(properties_disp, keymask_lookup[i]), False, 0);
+    // Keys and buttons pressed by the event belong to the caller until released.
+    if (event->type == EVENT_KEY_PRESSED || event->type == EVENT_MOUSE_PRESSED) {
+        held_mask |= event_mask;
+    } else {
+        held_mask &= ~event_mask;
+    }
+    synthetic_mask &= ~event_mask;
+    #endif
+}
+
+static void link_post_request(post_request *request) {
+    request->next = NULL;
+    post_request *prev = __atomic_exchange_n(&post_queue_head, request, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, request, __ATOMIC_RELEASE);
+}
+
+static void submit_post_request(post_request *request) {
+    link_post_request(request);
+    sem_post(&post_queue_sem);
+}
+
+/* Take the oldest request off the queue.  Returns NULL while a producer has
+ * swapped the head but not linked its node yet.
+ */
+static post_request *pop_post_request() {
+    post_request *request = NULL;
+    post_request *tail = post_queue_tail;
+    post_request *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    // Skip over the stub, it only keeps the queue from running empty.
+    if (tail == &post_queue_stub && next != NULL) {
+        post_queue_tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (tail != &post_queue_stub) {
+        if (next == NULL && tail == __atomic_load_n(&post_queue_head, __ATOMIC_ACQUIRE)) {
+            // The tail is the last request, put the stub behind it so it can be taken.
+            link_post_request(&post_queue_stub);
+            next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+        }
+
+        if (next != NULL) {
+            post_queue_tail = next;
+            request = tail;
         }
     }
 
-    for (unsigned int i = 0; i < sizeof(btnmask_lookup) / sizeof(unsigned int); i++) {
-        if (event->mask & btnmask_lookup[i]) {
-            XTestFakeButtonEvent(properties_disp, i + 1, False, 0);
+    return request;
+}
+
+static void wait_post_semaphore(sem_t *sem) {
+    // Interrupted waits are simply resumed.
+    while (sem_wait(sem) != 0) { }
+}
+
+static void *post_thread_proc(void *arg) {
+    bool running = true;
+    while (running) {
+        wait_post_semaphore(&post_queue_sem);
+
+        XLockDisplay(post_disp);
+
+        #ifdef USE_XTEST
+        load_keymask_keycodes();
+        #endif
+
+        // Drain whatever else is queued so a burst shares one flush.
+        post_request *finished = NULL;
+        bool is_sync = false;
+        unsigned int drained = 0;
+        do {
+            post_request *request;
+            while ((request = pop_post_request()) == NULL) {
+                // A producer is between swapping the head and linking its request.
+                sched_yield();
+            }
+
+            for (size_t i = 0; i < request->count; i++) {
+                post_event(&request->events[i]);
+            }
+
+            if (!(request->flags & POST_NO_SYNC)) {
+                is_sync = true;
+            }
+
+            if (request->is_stop) {
+                running = false;
+            }
+
+            request->next = finished;
+            finished = request;
+        } while (running && ++drained < POST_DRAIN_MAX && sem_trywait(&post_queue_sem) == 0);
+
+        #ifdef USE_XTEST
+        // Release the modifier keys and buttons used to fake the event masks.
+        post_mask_delta(0x0000, 0x0000);
+        #endif
+
+        // Don't forget to flush!
+        if (is_sync) {
+            XSync(post_disp, True);
+        } else {
+            XFlush(post_disp);
+        }
+        XUnlockDisplay(post_disp);
+
+        while (finished != NULL) {
+            post_request *next = finished->next;
+            if (finished->done != NULL) {
+                sem_post(finished->done);
+            } else {
+                free(finished);
+            }
+            finished = next;
+        }
+    }
+
+    return NULL;
+}
+
+// Open the posting connection and start the posting thread if they are not running.
+static bool start_post_thread() {
+    bool status = __atomic_load_n(&post_thread_running, __ATOMIC_ACQUIRE);
+
+    if (!status) {
+        pthread_mutex_lock(&post_thread_mutex);
+        if (!post_thread_running) {
+            post_disp = XOpenDisplay(XDisplayName(NULL));
+            if (post_disp != NULL) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: %s\n",
+                        __FUNCTION__, __LINE__, "XOpenDisplay success.");
+
+                sem_init(&post_queue_sem, 0, 0);
+                if (pthread_create(&post_thread_id, NULL, post_thread_proc, NULL) == 0) {
+                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Successfully created posting thread.\n",
+                            __FUNCTION__, __LINE__);
+
+                    __atomic_store_n(&post_thread_running, true, __ATOMIC_RELEASE);
+                } else {
+                    logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to create posting thread!\n",
+                            __FUNCTION__, __LINE__);
+
+                    sem_destroy(&post_queue_sem);
+                    XCloseDisplay(post_disp);
+                    post_disp = NULL;
+                }
+            } else {
+                logger(LOG_LEVEL_ERROR, "%s [%u]: %s\n",
+                        __FUNCTION__, __LINE__, "XOpenDisplay failure!");
+            }
+        }
+        status = post_thread_running;
+        pthread_mutex_unlock(&post_thread_mutex);
+    }
+
+    return status;
+}
+
+// Submit a request that borrows the caller's events and wait until the posting thread is done with it.
+static void wait_post_request(uiohook_event * const events, size_t count, uint8_t flags, bool is_stop) {
+    sem_t done;
+    sem_init(&done, 0, 0);
+
+    post_request request = {
+        .events = events,
+        .count = count,
+        .flags = flags,
+        .is_stop = is_stop,
+        .done = &done
+    };
+
+    submit_post_request(&request);
+    wait_post_semaphore(&done);
+    sem_destroy(&done);
+}
+
+/* Wait for everything the calling thread queued so far.  Functions that post
+ * directly on post_disp call this first so they never overtake the queue.
+ */
+static bool sync_post_queue() {
+    bool status = start_post_thread();
+    if (status) {
+        wait_post_request(NULL, 0, POST_NO_SYNC, false);
+    }
+
+    return status;
+}
+
+// Stop the posting thread and close its connection, called by on_library_unload().
+void unload_post_thread() {
+    pthread_mutex_lock(&post_thread_mutex);
+    if (post_thread_running) {
+        wait_post_request(NULL, 0, 0x00, true);
+        pthread_join(post_thread_id, NULL);
+        __atomic_store_n(&post_thread_running, false, __ATOMIC_RELEASE);
+
+        sem_destroy(&post_queue_sem);
+        post_queue_stub.next = NULL;
+        post_queue_head = &post_queue_stub;
+        post_queue_tail = &post_queue_stub;
+
+        XCloseDisplay(post_disp);
+        post_disp = NULL;
+
+        #ifdef USE_XTEST
+        keymask_valid = false;
+        #endif
+    }
+    pthread_mutex_unlock(&post_thread_mutex);
+}
+
+UIOHOOK_API void hook_post_events(uiohook_event * const events, size_t count, uint8_t flags) {
+    if (!start_post_thread()) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Posting is not available!\n",
+                __FUNCTION__, __LINE__);
+    } else if (flags & POST_NO_SYNC) {
+        // Copy the events so the caller can reuse its array as soon as we return.
+        post_request *request = malloc(sizeof(post_request) + sizeof(uiohook_event) * count);
+        if (request != NULL) {
+            request->events = (uiohook_event *) (request + 1);
+            request->count = count;
+            request->flags = flags;
+            request->is_stop = false;
+            request->done = NULL;
+            if (count > 0) {
+                memcpy(request->events, events, sizeof(uiohook_event) * count);
+            }
+
+            submit_post_request(request);
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for the post request!\n",
+                    __FUNCTION__, __LINE__);
+        }
+    } else {
+        wait_post_request(events, count, flags, false);
+    }
+}
+
+UIOHOOK_API void hook_post_event(uiohook_event * const event) {
+    hook_post_events(event, 1, 0x00);
+}
+
+// Playback sleeps until this long before an event is due, then spins.
+#define PLAYBACK_SPIN_NS 200000
+
+static inline int64_t timespec_to_ns(const struct timespec *ts) {
+    return (int64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+// Wait until the monotonic clock reaches deadline.
+static void wait_until(int64_t deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (deadline - timespec_to_ns(&now) > PLAYBACK_SPIN_NS) {
+        struct timespec wake = {
+            .tv_sec = (deadline - PLAYBACK_SPIN_NS) / 1000000000,
+            .tv_nsec = (deadline - PLAYBACK_SPIN_NS) % 1000000000
+        };
+
+        // Interrupted sleeps are simply resumed, the deadline is absolute.
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) != 0) { }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+
+    // The scheduler may wake us late, spin the tail for sub-millisecond accuracy.
+    while (timespec_to_ns(&now) < deadline) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    }
+}
+
+/* Nanoseconds after the first event that an event is due at speed, at most
+ * limit.  Event times are unsigned milliseconds, so an event stamped before
+ * the first one is due immediately instead of wrapping around.
+ */
+static int64_t get_playback_offset(uint64_t time, uint64_t first, double speed, int64_t limit) {
+    int64_t offset = 0;
+
+    if (speed > 0 && time > first) {
+        // Clamp before converting, a double past INT64_MAX does not convert.
+        double ns = (double) (time - first) * 1000000.0 / speed;
+        offset = ns < (double) limit ? (int64_t) ns : limit;
+        if (offset > limit) {
+            offset = limit;
+        }
+    }
+
+    return offset;
+}
+
+UIOHOOK_API int hook_play_events(uiohook_event * const events, size_t count, double speed, int64_t *errors) {
+    int status = UIOHOOK_FAILURE;
+
+    if ((events != NULL || count == 0) && sync_post_queue()) {
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        // Deadlines are relative to the first event and never move backwards.
+        int64_t start_ns = timespec_to_ns(&start);
+        int64_t deadline = start_ns;
+        for (size_t i = 0; i < count; i++) {
+            int64_t due = start_ns + get_playback_offset(events[i].time, events[0].time, speed, INT64_MAX - start_ns);
+            if (due > deadline) {
+                deadline = due;
+            }
+
+            wait_until(deadline);
+
+            // Take the lock per event so the posting thread and other callers can post in between.
+            XLockDisplay(post_disp);
+
+            #ifdef USE_XTEST
+            load_keymask_keycodes();
+            #endif
+
+            post_event(&events[i]);
+
+            #ifdef USE_XTEST
+            // Do not leave faked modifiers down while the lock is released.
+            post_mask_delta(0x0000, 0x0000);
+            #endif
+
+            XFlush(post_disp);
+            XUnlockDisplay(post_disp);
+
+            // The error is measured once the requests have been written to the server.
+            if (errors != NULL) {
+                struct timespec posted;
+                clock_gettime(CLOCK_MONOTONIC, &posted);
+                errors[i] = (timespec_to_ns(&posted) - deadline) / 1000;
+            }
+        }
+
+        // Don't forget to flush!
+        XLockDisplay(post_disp);
+        XSync(post_disp, True);
+        XUnlockDisplay(post_disp);
+
+        status = UIOHOOK_SUCCESS;
+    }
+
+    return status;
+}
+
+// Samples sent to the server per flush, and how far ahead of their time they are sent.
+#define PATH_BATCH_NS 16000000
+
+// Newton's method square root for segment lengths, saves the math.h depend.
+static double path_sqrt(double value) {
+    double root = value > 1 ? value : 1;
+    for (int i = 0; i < 64 && value > 0; i++) {
+        double next = (root + value / root) / 2;
+        if (next >= root) {
+            break;
+        }
+        root = next;
+    }
+
+    return value > 0 ? root : 0;
+}
+
+static inline int16_t path_round(double value) {
+    return (int16_t) (value < 0 ? value - 0.5 : value + 0.5);
+}
+
+/* The time of sample i of samples from the start of a path, in nanoseconds.
+ * The integer product i * duration_ms * 1000000 overflows 64 bits for paths
+ * longer than about 1.5 hours at 1 kHz, so it is computed in double.  The
+ * result never exceeds duration_ms * 1000000, well within the 53 bit mantissa.
+ * The path tests call this and the two functions below directly.
+ */
+int64_t get_path_sample_time(uint64_t i, uint64_t samples, uint32_t duration_ms) {
+    return (int64_t) ((double) i * duration_ms * 1000000.0 / (double) samples);
+}
+
+// Cumulative length of each polyline segment end, for constant speed sampling.
+double * build_path_lengths(const path_point *points, size_t count) {
+    double *lengths = malloc(sizeof(double) * count);
+    if (lengths != NULL) {
+        lengths[0] = 0;
+        for (size_t i = 1; i < count; i++) {
+            double dx = points[i].x - points[i - 1].x;
+            double dy = points[i].y - points[i - 1].y;
+            lengths[i] = lengths[i - 1] + path_sqrt(dx * dx + dy * dy);
+        }
+    }
+
+    return lengths;
+}
+
+// The point at fraction t of the path, scratch holds 2 * count doubles for Bezier paths.
+path_point get_path_point(const path_point *points, size_t count, uint8_t type,
+        const double *lengths, double *scratch, double t) {
+    double x = points[0].x, y = points[0].y;
+
+    if (type == PATH_BEZIER) {
+        // De Casteljau's algorithm.
+        for (size_t i = 0; i < count; i++) {
+            scratch[i * 2] = points[i].x;
+            scratch[i * 2 + 1] = points[i].y;
+        }
+
+        for (size_t n = count - 1; n > 0; n--) {
+            for (size_t i = 0; i < n; i++) {
+                scratch[i * 2] += (scratch[(i + 1) * 2] - scratch[i * 2]) * t;
+                scratch[i * 2 + 1] += (scratch[(i + 1) * 2 + 1] - scratch[i * 2 + 1]) * t;
+            }
+        }
+
+        x = scratch[0];
+        y = scratch[1];
+    } else if (count > 1 && lengths[count - 1] > 0) {
+        double distance = lengths[count - 1] * t;
+
+        size_t i = 1;
+        while (i < count - 1 && lengths[i] < distance) {
+            i++;
+        }
+
+        double segment = lengths[i] - lengths[i - 1];
+        double fraction = segment > 0 ? (distance - lengths[i - 1]) / segment : 1;
+        x = points[i - 1].x + (points[i].x - points[i - 1].x) * fraction;
+        y = points[i - 1].y + (points[i].y - points[i - 1].y) * fraction;
+    }
+
+    return (path_point) { .x = path_round(x), .y = path_round(y) };
+}
+
+UIOHOOK_API int hook_post_mouse_path(const path_point *points, size_t count, uint8_t type, uint32_t rate, uint32_t duration_ms, uint16_t mask) {
+    int status = UIOHOOK_FAILURE;
+
+    if (points == NULL || count == 0 || (type != PATH_POLYLINE && type != PATH_BEZIER)) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Invalid pointer path!\n",
+                __FUNCTION__, __LINE__);
+
+        return status;
+    }
+
+    if (!sync_post_queue()) {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Posting is not available!\n",
+                __FUNCTION__, __LINE__);
+
+        return status;
+    }
+
+    double *lengths = build_path_lengths(points, count);
+    double *scratch = malloc(sizeof(double) * count * 2);
+    if (lengths != NULL && scratch != NULL) {
+        // Sample 0 is the first point, the rest are spaced evenly over the duration.
+        uint64_t samples = (uint64_t) duration_ms * rate / 1000;
+        if (samples == 0) {
+            samples = 1;
+        }
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        #ifdef USE_XTEST
+        /* Move to the first point, then hold the mask for the whole path.  The
+         * keys and buttons are handed to the caller's side of the tracking so
+         * other threads posting between batches do not release them.
+         */
+        XLockDisplay(post_disp);
+        load_keymask_keycodes();
+        XTestFakeMotionEvent(post_disp, -1, points[0].x, points[0].y, 0);
+        uint16_t pressed = mask & ~held_mask;
+        post_mask_delta(mask, 0x0000);
+        synthetic_mask &= ~pressed;
+        XUnlockDisplay(post_disp);
+
+        /* The server spaces the samples with the XTest delay argument, so a
+         * whole batch is written at once and the client only wakes per batch.
+         * Delays are whole milliseconds, derived from the rounded sample times
+         * so the rounding never accumulates.
+         */
+        uint64_t previous_ms = 0;
+        for (uint64_t i = 1; i <= samples; ) {
+            int64_t batch_start = get_path_sample_time(i, samples, duration_ms);
+            wait_until(timespec_to_ns(&start) + batch_start - PATH_BATCH_NS);
+
+            XLockDisplay(post_disp);
+            for (; i <= samples && get_path_sample_time(i, samples, duration_ms) < batch_start + PATH_BATCH_NS; i++) {
+                uint64_t sample_ms = (get_path_sample_time(i, samples, duration_ms) + 500000) / 1000000;
+                path_point point = get_path_point(points, count, type, lengths, scratch, (double) i / samples);
+
+                XTestFakeMotionEvent(post_disp, -1, point.x, point.y, sample_ms - previous_ms);
+                previous_ms = sample_ms;
+            }
+            XFlush(post_disp);
+            XUnlockDisplay(post_disp);
+        }
+
+        XLockDisplay(post_disp);
+        synthetic_mask |= pressed;
+        post_mask_delta(0x0000, 0x0000);
+        XSync(post_disp, True);
+        XUnlockDisplay(post_disp);
+        #else
+        uiohook_event event = {
+            .type = (mask & (MASK_BUTTON1 | MASK_BUTTON2 | MASK_BUTTON3 | MASK_BUTTON4 | MASK_BUTTON5)) ? EVENT_MOUSE_DRAGGED : EVENT_MOUSE_MOVED,
+            .mask = mask
+        };
+
+        for (uint64_t i = 0; i <= samples; i++) {
+            wait_until(timespec_to_ns(&start) + get_path_sample_time(i, samples, duration_ms));
+
+            path_point point = get_path_point(points, count, type, lengths, scratch, (double) i / samples);
+            event.data.mouse.x = point.x;
+            event.data.mouse.y = point.y;
+
+            XLockDisplay(post_disp);
+            post_mouse_motion_event(&event);
+            XFlush(post_disp);
+            XUnlockDisplay(post_disp);
+        }
+
+        XLockDisplay(post_disp);
+        XSync(post_disp, True);
+        XUnlockDisplay(post_disp);
+        #endif
+
+        status = UIOHOOK_SUCCESS;
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for the pointer path!\n",
+                __FUNCTION__, __LINE__);
+
+        status = UIOHOOK_ERROR_OUT_OF_MEMORY;
+    }
+
+    free(scratch);
+    free(lengths);
+
+    return status;
+}
+
+/* Decode one UTF-8 sequence, returning 0xFFFD for malformed input.  Overlong
+ * forms, UTF-16 surrogates and code points past 0x10FFFF are malformed.  A
+ * malformed sequence only consumes its first byte.  Not static so the tests
+ * can check it without a display.
+ */
+uint32_t decode_utf8(const unsigned char **cursor) {
+    const unsigned char *bytes = *cursor;
+    uint32_t unicode = 0xFFFD;
+    size_t length = 1;
+
+    if (bytes[0] < 0x80) {
+        unicode = bytes[0];
+    } else if ((bytes[0] & 0xE0) == 0xC0 && (bytes[1] & 0xC0) == 0x80) {
+        uint32_t value = ((bytes[0] & 0x1F) << 6) | (bytes[1] & 0x3F);
+        if (value >= 0x80) {
+            unicode = value;
+            length = 2;
+        }
+    } else if ((bytes[0] & 0xF0) == 0xE0 && (bytes[1] & 0xC0) == 0x80 && (bytes[2] & 0xC0) == 0x80) {
+        uint32_t value = ((bytes[0] & 0x0F) << 12) | ((bytes[1] & 0x3F) << 6) | (bytes[2] & 0x3F);
+        if (value >= 0x800 && (value < 0xD800 || value > 0xDFFF)) {
+            unicode = value;
+            length = 3;
+        }
+    } else if ((bytes[0] & 0xF8) == 0xF0 && (bytes[1] & 0xC0) == 0x80 && (bytes[2] & 0xC0) == 0x80 && (bytes[3] & 0xC0) == 0x80) {
+        uint32_t value = ((bytes[0] & 0x07) << 18) | ((bytes[1] & 0x3F) << 12) | ((bytes[2] & 0x3F) << 6) | (bytes[3] & 0x3F);
+        if (value >= 0x10000 && value <= 0x10FFFF) {
+            unicode = value;
+            length = 4;
+        }
+    }
+
+    *cursor += length;
+    return unicode;
+}
+
+#ifdef USE_XTEST
+// Characters the current keymap can type, sorted by Unicode value for bsearch().
+typedef struct _text_key {
+    uint32_t unicode;
+    KeyCode keycode;
+    uint8_t mods;       // Real modifiers to hold down while the key is pressed.
+} text_key;
+
+static text_key *text_keys = NULL;
+static size_t text_key_count = 0;
+
+// Keymap state the text keys were built for.
+static bool text_keys_valid = false;
+static unsigned long text_keys_serial = 0;
+static unsigned char text_keys_group = 0;
+static unsigned char text_keys_locked = 0;
+
+// First key code bound to each of the eight real modifiers.
+static KeyCode text_mod_keycodes[8];
+
+/* Key codes without any symbols, used to type characters missing from the
+ * keymap.  The keymap is shared by every client on the display, so bindings
+ * only last until the end of the hook_post_text() call that made them.  The
+ * spares are kept sorted by key code so neighbours can be bound in one request.
+ */
+#define TEXT_SPARE_COUNT 16
+static struct _text_spare {
+    KeyCode keycode;
+    KeySym keysym;
+    bool is_pending;    // keysym has not been sent to the server yet
+    bool is_used;       // keysym is typed by the current chunk
+} text_spares[TEXT_SPARE_COUNT];
+static size_t text_spare_count = 0;
+
+// How long clients get to handle typed keys before their spare key codes are rebound.
+#define TEXT_SPARE_SETTLE_MS 20
+
+static uint32_t text_keysym_to_unicode(KeySym keysym) {
+    uint32_t unicode = 0;
+
+    switch (keysym) {
+        case XK_BackSpace:
+            unicode = '\b';
+            break;
+
+        case XK_Tab:
+            unicode = '\t';
+            break;
+
+        case XK_Return:
+            unicode = '\n';
+            break;
+
+        default:
+            if ((keysym & 0xFF000000) == 0x01000000) {
+                // Unicode key symbols outside of the BMP.
+                unicode = keysym & 0x00FFFFFF;
+            } else {
+                uint16_t buffer[2];
+                size_t count = keysym_to_unicode(keysym, buffer, sizeof(buffer) / sizeof(uint16_t));
+                if (count == 1) {
+                    unicode = buffer[0];
+                } else if (count == 2) {
+                    unicode = 0x10000 + (((buffer[0] & 0x3FF) << 10) | (buffer[1] & 0x3FF));
+                }
+            }
+            break;
+    }
+
+    return unicode;
+}
+
+static KeySym text_unicode_to_keysym(uint32_t unicode) {
+    KeySym keysym;
+
+    switch (unicode) {
+        case '\b':
+            keysym = XK_BackSpace;
+            break;
+
+        case '\t':
+            keysym = XK_Tab;
+            break;
+
+        case '\n':
+            keysym = XK_Return;
+            break;
+
+        default:
+            if (unicode <= 0xFFFF) {
+                keysym = unicode_to_keysym((uint16_t) unicode);
+            } else {
+                keysym = unicode | 0x01000000;
+            }
+            break;
+    }
+
+    return keysym;
+}
+
+static unsigned int count_bits(unsigned int value) {
+    unsigned int count = 0;
+    for (; value != 0; value &= value - 1) {
+        count++;
+    }
+
+    return count;
+}
+
+// Order by character, then by the fewest modifiers, so the first match is the simplest.
+static int compare_text_keys(const void *a, const void *b) {
+    const text_key *left = (const text_key *) a;
+    const text_key *right = (const text_key *) b;
+
+    int result;
+    if (left->unicode != right->unicode) {
+        result = left->unicode < right->unicode ? -1 : 1;
+    } else if (count_bits(left->mods) != count_bits(right->mods)) {
+        result = count_bits(left->mods) < count_bits(right->mods) ? -1 : 1;
+    } else {
+        result = (int) left->keycode - (int) right->keycode;
+    }
+
+    return result;
+}
+
+static int compare_text_key_unicode(const void *a, const void *b) {
+    uint32_t left = ((const text_key *) a)->unicode;
+    uint32_t right = ((const text_key *) b)->unicode;
+
+    return (left > right) - (left < right);
+}
+
+static int compare_text_spare_keycode(const void *a, const void *b) {
+    KeyCode left = ((const struct _text_spare *) a)->keycode;
+    KeyCode right = ((const struct _text_spare *) b)->keycode;
+
+    return (left > right) - (left < right);
+}
+
+static bool is_text_spare(KeyCode keycode) {
+    for (size_t i = 0; i < text_spare_count; i++) {
+        if (text_spares[i].keycode == keycode) {
+            return true;
         }
     }
+
+    return false;
+}
+
+// The shift level a key type selects for a modifier state.
+static unsigned int get_type_level(XkbKeyTypePtr type, unsigned int mods) {
+    unsigned int level = 0;
+
+    mods &= type->mods.mask;
+    for (unsigned int i = 0; i < type->map_count; i++) {
+        if (type->map[i].active && type->map[i].mods.mask == mods) {
+            level = type->map[i].level;
+            break;
+        }
+    }
+
+    return level;
+}
+
+/* Build the reverse index from Unicode to key code and modifiers for the
+ * effective group and locked modifiers.  Only Shift and the modifiers bound to
+ * ISO_Level3_Shift or ISO_Level5_Shift are pressed to reach a level.
+ */
+static int build_text_keys(unsigned char group, unsigned char locked) {
+    int status = UIOHOOK_FAILURE;
+
+    XkbDescPtr map = XkbGetMap(post_disp, XkbAllClientInfoMask, XkbUseCoreKbd);
+    XModifierKeymap *modmap = XGetModifierMapping(post_disp);
+    if (map != NULL && modmap != NULL) {
+        uint8_t level_mods = ShiftMask;
+        for (unsigned int i = 0; i < 8; i++) {
+            text_mod_keycodes[i] = 0;
+
+            for (int j = modmap->max_keypermod - 1; j >= 0; j--) {
+                KeyCode keycode = modmap->modifiermap[i * modmap->max_keypermod + j];
+                if (keycode >= map->min_key_code && keycode <= map->max_key_code) {
+                    text_mod_keycodes[i] = keycode;
+
+                    KeySym keysym = XkbKeyNumSyms(map, keycode) > 0 ? XkbKeySymEntry(map, keycode, 0, 0) : NoSymbol;
+                    if (keysym == XK_ISO_Level3_Shift || keysym == XK_ISO_Level5_Shift) {
+                        level_mods |= 1 << i;
+                    }
+                }
+            }
+        }
+
+        if (text_mod_keycodes[ShiftMapIndex] == 0) {
+            level_mods &= ~ShiftMask;
+        }
+
+        // Keep the spares that still carry our binding, then add unbound key codes.
+        size_t kept = 0;
+        for (size_t i = 0; i < text_spare_count; i++) {
+            KeyCode keycode = text_spares[i].keycode;
+            if (keycode >= map->min_key_code && keycode <= map->max_key_code && XkbKeyNumSyms(map, keycode) > 0
+                    && XkbKeySymEntry(map, keycode, 0, 0) == text_spares[i].keysym) {
+                text_spares[kept] = text_spares[i];
+                text_spares[kept].is_pending = false;
+                text_spares[kept].is_used = false;
+                kept++;
+            }
+        }
+        text_spare_count = kept;
+
+        for (unsigned int keycode = map->min_key_code; keycode <= map->max_key_code && text_spare_count < TEXT_SPARE_COUNT; keycode++) {
+            bool is_unbound = true;
+            for (int i = 0; i < XkbKeyNumSyms(map, keycode); i++) {
+                if (XkbKeySymsPtr(map, keycode)[i] != NoSymbol) {
+                    is_unbound = false;
+                }
+            }
+
+            if (is_unbound && !is_text_spare(keycode)) {
+                text_spares[text_spare_count++] = (struct _text_spare) { .keycode = keycode, .keysym = NoSymbol };
+            }
+        }
+        qsort(text_spares, text_spare_count, sizeof(struct _text_spare), compare_text_spare_keycode);
+
+        // Every key contributes at most one entry per modifier state of its type.
+        unsigned int max_states = 1;
+        for (unsigned int i = 0; i < map->map->num_types; i++) {
+            if (map->map->types[i].map_count + 1u > max_states) {
+                max_states = map->map->types[i].map_count + 1u;
+            }
+        }
+
+        size_t capacity = (map->max_key_code - map->min_key_code + 1) * max_states;
+        text_key *keys = malloc(sizeof(text_key) * capacity);
+        if (keys != NULL) {
+            size_t count = 0;
+            for (unsigned int keycode = map->min_key_code; keycode <= map->max_key_code; keycode++) {
+                unsigned int num_groups = XkbKeyNumGroups(map, keycode);
+                if (num_groups == 0 || is_text_spare(keycode)) {
+                    continue;
+                }
+
+                unsigned int key_group = group % num_groups;
+                XkbKeyTypePtr type = XkbKeyKeyType(map, keycode, key_group);
+
+                // Try no modifiers, then each modifier state named by the key type.
+                for (int i = -1; i < (int) type->map_count && count < capacity; i++) {
+                    uint8_t mods = 0;
+                    if (i >= 0) {
+                        mods = type->map[i].mods.mask;
+                        if (!type->map[i].active || mods == 0 || (mods & ~level_mods) != 0) {
+                            continue;
+                        }
+                    }
+
+                    unsigned int level = get_type_level(type, mods | locked);
+                    uint32_t unicode = text_keysym_to_unicode(XkbKeySymEntry(map, keycode, level, key_group));
+                    if (unicode != 0) {
+                        keys[count++] = (text_key) { .unicode = unicode, .keycode = keycode, .mods = mods };
+                    }
+                }
+            }
+
+            qsort(keys, count, sizeof(text_key), compare_text_keys);
+
+            // Keep the simplest way to type each character.
+            size_t unique = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (unique == 0 || keys[unique - 1].unicode != keys[i].unicode) {
+                    keys[unique++] = keys[i];
+                }
+            }
+
+            free(text_keys);
+            text_keys = keys;
+            text_key_count = unique;
+
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Indexed %zu typeable character(s) with %zu spare key code(s).\n",
+                    __FUNCTION__, __LINE__, text_key_count, text_spare_count);
+
+            status = UIOHOOK_SUCCESS;
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to allocate memory for the text keys!\n",
+                    __FUNCTION__, __LINE__);
+
+            status = UIOHOOK_ERROR_OUT_OF_MEMORY;
+        }
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to get the keyboard map!\n",
+                __FUNCTION__, __LINE__);
+    }
+
+    if (modmap != NULL) {
+        XFreeModifiermap(modmap);
+    }
+
+    if (map != NULL) {
+        XkbFreeKeyboard(map, XkbAllComponentsMask, True);
+    }
+
+    return status;
+}
+
+// Rebuild the text keys if the keymap, effective group or locked modifiers changed.
+static int load_text_keys() {
+    int status = UIOHOOK_SUCCESS;
+
+    XkbStateRec state;
+    if (XkbGetState(post_disp, XkbUseCoreKbd, &state) != Success) {
+        state.group = 0;
+        state.locked_mods = 0;
+    }
+
+    unsigned long serial = get_keyboard_map_serial();
+    if (!text_keys_valid || serial != text_keys_serial
+            || state.group != text_keys_group || state.locked_mods != text_keys_locked) {
+        status = build_text_keys(state.group, state.locked_mods);
+
+        text_keys_valid = (status == UIOHOOK_SUCCESS);
+        text_keys_serial = serial;
+        text_keys_group = state.group;
+        text_keys_locked = state.locked_mods;
+    }
+
+    return status;
+}
+
+// Press and release the modifier keys that differ between two real modifier masks.
+static void post_text_mods(uint8_t from, uint8_t to) {
+    for (unsigned int i = 0; i < 8; i++) {
+        if ((from & ~to) & 1 << i && text_mod_keycodes[i] != 0) {
+            XTestFakeKeyEvent(post_disp, text_mod_keycodes[i], False, 0);
+        }
+    }
+
+    for (unsigned int i = 0; i < 8; i++) {
+        if ((to & ~from) & 1 << i && text_mod_keycodes[i] != 0) {
+            XTestFakeKeyEvent(post_disp, text_mod_keycodes[i], True, 0);
+        }
+    }
+}
+
+// Find the key that types a character with the current keymap.
+static inline text_key * find_text_key(uint32_t unicode) {
+    text_key search = { .unicode = unicode };
+
+    return bsearch(&search, text_keys, text_key_count, sizeof(text_key), compare_text_key_unicode);
+}
+
+// Find the spare key code bound to a key symbol, 0 if there is none.
+static KeyCode find_text_spare(KeySym keysym) {
+    KeyCode keycode = 0;
+
+    for (size_t i = 0; i < text_spare_count && keycode == 0; i++) {
+        if (text_spares[i].keysym == keysym) {
+            keycode = text_spares[i].keycode;
+        }
+    }
+
+    return keycode;
+}
+
+/* Assign a spare key code to every key symbol missing from the keymap, starting
+ * at cursor.  Bindings left by the previous chunk are reused when they match,
+ * other spares are only rebound if the chunk does not need them.  The chunk ends
+ * before the first character that finds no spare left, which is returned.
+ */
+static const unsigned char * plan_text_chunk(const unsigned char *cursor) {
+    for (size_t i = 0; i < text_spare_count; i++) {
+        text_spares[i].is_used = false;
+    }
+
+    bool is_full = false;
+    while (*cursor != '\0' && !is_full) {
+        const unsigned char *next = cursor;
+        uint32_t unicode = decode_utf8(&next);
+
+        KeySym keysym = NoSymbol;
+        if (unicode != '\r' && find_text_key(unicode) == NULL) {
+            keysym = text_unicode_to_keysym(unicode);
+        }
+
+        if (keysym != NoSymbol && text_spare_count > 0) {
+            struct _text_spare *spare = NULL;
+            for (size_t i = 0; i < text_spare_count && spare == NULL; i++) {
+                if (text_spares[i].keysym == keysym) {
+                    spare = &text_spares[i];
+                }
+            }
+
+            for (size_t i = 0; i < text_spare_count && spare == NULL; i++) {
+                if (!text_spares[i].is_used) {
+                    spare = &text_spares[i];
+                    spare->keysym = keysym;
+                    spare->is_pending = true;
+                }
+            }
+
+            if (spare != NULL) {
+                spare->is_used = true;
+            } else {
+                is_full = true;
+            }
+        }
+
+        if (!is_full) {
+            cursor = next;
+        }
+    }
+
+    return cursor;
+}
+
+/* Send the pending spare bindings.  Each XChangeKeyboardMapping() makes the
+ * server send MappingNotify to every client, so spares with consecutive key
+ * codes are changed with a single request.
+ */
+static void bind_text_spares() {
+    KeySym keysyms[TEXT_SPARE_COUNT * 2];
+
+    size_t i = 0;
+    while (i < text_spare_count) {
+        if (text_spares[i].is_pending) {
+            // Extend the run over consecutive key codes up to the last pending spare.
+            size_t last = i;
+            for (size_t j = i + 1; j < text_spare_count && text_spares[j].keycode == text_spares[j - 1].keycode + 1; j++) {
+                if (text_spares[j].is_pending) {
+                    last = j;
+                }
+            }
+
+            for (size_t j = i; j <= last; j++) {
+                // Both levels, so the server does not derive a different case for the second.
+                keysyms[(j - i) * 2] = text_spares[j].keysym;
+                keysyms[(j - i) * 2 + 1] = text_spares[j].keysym;
+                text_spares[j].is_pending = false;
+            }
+
+            XChangeKeyboardMapping(post_disp, text_spares[i].keycode, 2, keysyms, (int) (last - i + 1));
+            i = last + 1;
+        } else {
+            i++;
+        }
+    }
+}
+
+// Restore the spare key codes bound by bind_text_spares() to NoSymbol.
+static void unbind_text_spares() {
+    for (size_t i = 0; i < text_spare_count; i++) {
+        if (text_spares[i].keysym != NoSymbol) {
+            text_spares[i].keysym = NoSymbol;
+            text_spares[i].is_pending = true;
+        }
+    }
+
+    bind_text_spares();
+}
+#endif
+
+UIOHOOK_API int hook_post_text(const char *utf8) {
+    int status = UIOHOOK_FAILURE;
+
+    #ifdef USE_XTEST
+    if (utf8 != NULL && sync_post_queue()) {
+        XLockDisplay(post_disp);
+        status = load_text_keys();
+
+        if (status == UIOHOOK_SUCCESS) {
+            uint8_t mods = 0;
+
+            const unsigned char *cursor = (const unsigned char *) utf8;
+            while (*cursor != '\0') {
+                // Bind what the next chunk of text is missing from the keymap.
+                const unsigned char *end = plan_text_chunk(cursor);
+                bind_text_spares();
+
+                while (cursor < end) {
+                    uint32_t unicode = decode_utf8(&cursor);
+                    if (unicode == '\r') {
+                        // Carriage returns are typed with the \n that usually follows.
+                        continue;
+                    }
+
+                    text_key *key = find_text_key(unicode);
+
+                    KeyCode keycode = 0;
+                    uint8_t key_mods = 0;
+                    if (key != NULL) {
+                        keycode = key->keycode;
+                        key_mods = key->mods;
+                    } else {
+                        keycode = find_text_spare(text_unicode_to_keysym(unicode));
+                    }
+
+                    if (keycode != 0) {
+                        post_text_mods(mods, key_mods);
+                        mods = key_mods;
+
+                        XTestFakeKeyEvent(post_disp, keycode, True, 0);
+                        XTestFakeKeyEvent(post_disp, keycode, False, 0);
+                    } else {
+                        logger(LOG_LEVEL_WARN, "%s [%u]: Unable to type character %#X!\n",
+                                __FUNCTION__, __LINE__, unicode);
+                    }
+                }
+
+                if (*cursor != '\0') {
+                    // The spares ran out, let the typed keys reach the clients before
+                    // the next chunk rebinds their key codes.
+                    XSync(post_disp, True);
+
+                    struct timespec settle = { 0, TEXT_SPARE_SETTLE_MS * 1000 * 1000 };
+                    nanosleep(&settle, NULL);
+                }
+            }
+
+            post_text_mods(mods, 0);
+        }
+
+        // Don't forget to flush!
+        XSync(post_disp, True);
+
+        // Let the key events reach the server before their bindings go away.
+        unbind_text_spares();
+        XSync(post_disp, True);
+        XUnlockDisplay(post_disp);
+    }
+    #else
+    logger(LOG_LEVEL_ERROR, "%s [%u]: Typing text requires the XTest extension!\n",
+            __FUNCTION__, __LINE__);
     #endif
 
-    // Don't forget to flush!
-    XSync(properties_disp, True);
-    XUnlockDisplay(properties_disp);
+    return status;
 }
@@ -16,12 +16,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <uiohook.h>
+#include <X11/Xatom.h>
 #include <X11/Xlib.h>
 #include <X11/XKBlib.h>
+#include <X11/Xresource.h>
 
 #ifdef USE_XF86MISC
 #include <X11/extensions/xf86misc.h>
@@ -31,7 +35,6 @@
 #if defined(USE_XINERAMA) && !defined(USE_XRANDR)
 #include <X11/extensions/Xinerama.h>
 #elif defined(USE_XRANDR)
-#include <pthread.h>
 #include <X11/extensions/Xrandr.h>
 #endif
 
@@ -47,88 +50,55 @@ static Display *xt_disp;
 
 Display *properties_disp;
 
-#ifdef USE_XRANDR
-static pthread_mutex_t xrandr_mutex = PTHREAD_MUTEX_INITIALIZER;
-static XRRScreenResources *xrandr_resources = NULL;
+// Posting thread and connection provided by post_event.c.
+extern void unload_post_thread();
 
-static void settings_cleanup_proc(void *arg) {
-    if (pthread_mutex_trylock(&xrandr_mutex) == 0) {
-        if (xrandr_resources != NULL) {
-            XRRFreeScreenResources(xrandr_resources);
-            xrandr_resources = NULL;
-        }
+// Settings thread used to listen for server side configuration changes.
+static pthread_t settings_thread_id;
+static pthread_mutex_t settings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t settings_cond = PTHREAD_COND_INITIALIZER;
+static bool settings_thread_started = false;
+static bool settings_thread_running = false;
+static Atom settings_stop_atom = None;
 
-        if (arg != NULL) {
-            XCloseDisplay((Display *) arg);
-            arg = NULL;
-        }
+/* Private window on the settings connection that on_library_unload() sends the
+ * stop message to.  The root window is shared with every other libuiohook
+ * process on the display, so a stop message sent there would stop them all.
+ */
+static Window settings_stop_window = None;
 
-        pthread_mutex_unlock(&xrandr_mutex);
-    }
-}
+// Cached screen layout, rebuilt by the settings thread when the layout changes.
+static pthread_mutex_t screen_mutex = PTHREAD_MUTEX_INITIALIZER;
+static screen_data *screen_cache = NULL;
+static uint8_t screen_cache_count = 0;
 
-static void *settings_thread_proc(void *arg) {
-    Display *settings_disp = XOpenDisplay(XDisplayName(NULL));;
-    if (settings_disp != NULL) {
-        logger(LOG_LEVEL_DEBUG, "%s [%u]: %s\n",
-                __FUNCTION__, __LINE__, "XOpenDisplay success.");
+// Multi-click time resolved at load and refreshed when RESOURCE_MANAGER changes.
+static pthread_mutex_t click_time_mutex = PTHREAD_MUTEX_INITIALIZER;
+static long int multi_click_time = -1;
 
-        pthread_cleanup_push(settings_cleanup_proc, settings_disp);
+// Core keyboard indicator state, updated by the settings thread.
+static pthread_mutex_t indicator_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long indicator_serial = 0;
+static unsigned int indicator_state = 0x00;
+static Time indicator_time = CurrentTime;
 
-        int event_base = 0;
-        int error_base = 0;
-        if (XRRQueryExtension(settings_disp, &event_base, &error_base)) {
-            Window root = XDefaultRootWindow(settings_disp);
-            unsigned long event_mask = RRScreenChangeNotifyMask;
-            XRRSelectInput(settings_disp, root, event_mask);
-
-            XEvent ev;
-
-            while(settings_disp != NULL) {
-                XNextEvent(settings_disp, &ev);
-
-                if (ev.type == event_base + RRScreenChangeNotifyMask) {
-                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Received XRRScreenChangeNotifyEvent.\n",
-                            __FUNCTION__, __LINE__);
-
-                    pthread_mutex_lock(&xrandr_mutex);
-                    if (xrandr_resources != NULL) {
-                        XRRFreeScreenResources(xrandr_resources);
-                    }
-
-                    xrandr_resources = XRRGetScreenResources(settings_disp, root);
-                    if (xrandr_resources == NULL) {
-                        logger(LOG_LEVEL_WARN, "%s [%u]: XRandR could not get screen resources!\n",
-                                __FUNCTION__, __LINE__);
-                    }
-                    pthread_mutex_unlock(&xrandr_mutex);
-                } else {
-                    logger(LOG_LEVEL_WARN, "%s [%u]: XRandR is not currently available!\n",
-                            __FUNCTION__, __LINE__);
-                }
-            }
-        }
+// Core pointer button mapping, refreshed by the settings thread on MappingNotify.
+static pthread_mutex_t button_map_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long button_map_serial = 0;
+static unsigned char button_map[256];
+static int button_map_count = 0;
 
-        // Execute the thread cleanup handler.
-        pthread_cleanup_pop(1);
+// Bumped by the settings thread whenever the keyboard mapping changes.
+static unsigned long keyboard_map_serial = 0;
 
-    } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: XOpenDisplay failure!\n",
-                __FUNCTION__, __LINE__);
-    }
-
-    return NULL;
-}
-#endif
-
-UIOHOOK_API screen_data* hook_create_screen_info(unsigned char *count) {
+static screen_data* query_screen_info(Display *disp, uint8_t *count) {
     *count = 0;
     screen_data *screens = NULL;
 
     #if defined(USE_XINERAMA) && !defined(USE_XRANDR)
-    if (XineramaIsActive(properties_disp)) {
+    if (XineramaIsActive(disp)) {
         int xine_count = 0;
-        XineramaScreenInfo *xine_info = XineramaQueryScreens(properties_disp, &xine_count);
+        XineramaScreenInfo *xine_info = XineramaQueryScreens(disp, &xine_count);
 
         if (xine_info != NULL) {
             if (xine_count > UINT8_MAX) {
@@ -158,7 +128,7 @@ UIOHOOK_API screen_data* hook_create_screen_info(unsigned char *count) {
         }
     }
     #elif defined(USE_XRANDR)
-    pthread_mutex_lock(&xrandr_mutex);
+    XRRScreenResources *xrandr_resources = XRRGetScreenResources(disp, XDefaultRootWindow(disp));
     if (xrandr_resources != NULL) {
         int xrandr_count = xrandr_resources->ncrtc;
         if (xrandr_count > UINT8_MAX) {
@@ -174,7 +144,7 @@ UIOHOOK_API screen_data* hook_create_screen_info(unsigned char *count) {
 
         if (screens != NULL) {
             for (int i = 0; i < xrandr_count; i++) {
-                XRRCrtcInfo *crtc_info = XRRGetCrtcInfo(properties_disp, xrandr_resources, xrandr_resources->crtcs[i]);
+                XRRCrtcInfo *crtc_info = XRRGetCrtcInfo(disp, xrandr_resources, xrandr_resources->crtcs[i]);
 
                 if (crtc_info != NULL) {
                     screens[i] = (screen_data) {
@@ -187,15 +157,27 @@ UIOHOOK_API screen_data* hook_create_screen_info(unsigned char *count) {
 
                     XRRFreeCrtcInfo(crtc_info);
                 } else {
+                    screens[i] = (screen_data) {
+                        .number = i + 1,
+                        .x = 0,
+                        .y = 0,
+                        .width = 0,
+                        .height = 0
+                    };
+
                     logger(LOG_LEVEL_WARN, "%s [%u]: XRandr failed to return crtc information! (%#X)\n",
                             __FUNCTION__, __LINE__, xrandr_resources->crtcs[i]);
                 }
             }
         }
+
+        XRRFreeScreenResources(xrandr_resources);
+    } else {
+        logger(LOG_LEVEL_WARN, "%s [%u]: XRandR could not get screen resources!\n",
+                __FUNCTION__, __LINE__);
     }
-    pthread_mutex_unlock(&xrandr_mutex);
     #else
-    Screen* default_screen = DefaultScreenOfDisplay(properties_disp);
+    Screen* default_screen = DefaultScreenOfDisplay(disp);
 
     if (default_screen->width > 0 && default_screen->height > 0) {
         screens = malloc(sizeof(screen_data));
@@ -213,9 +195,379 @@ UIOHOOK_API screen_data* hook_create_screen_info(unsigned char *count) {
     }
     #endif
 
+    if (screens == NULL) {
+        *count = 0;
+    }
+
+    return screens;
+}
+
+// Rebuild the cached screen layout.
+static void refresh_screen_info(Display *disp) {
+    uint8_t count;
+    screen_data *screens = query_screen_info(disp, &count);
+
+    pthread_mutex_lock(&screen_mutex);
+    if (screen_cache != NULL) {
+        free(screen_cache);
+    }
+
+    screen_cache = screens;
+    screen_cache_count = count;
+    pthread_mutex_unlock(&screen_mutex);
+
+    logger(LOG_LEVEL_DEBUG, "%s [%u]: Cached %u screen(s).\n",
+            __FUNCTION__, __LINE__, count);
+}
+
+// Resolve the multi-click time from the X Toolkit or the X resource database.
+static long int resolve_multi_click_time() {
+    long int value = 200;
+    int click_time;
+    bool successful = false;
+
+    #ifdef USE_XT
+    // Check and make sure we could connect to the x server.
+    if (xt_disp != NULL) {
+        // Try and use the Xt extention to get the current multi-click.
+        if (!successful) {
+            // Fall back to the X Toolkit extension if available and other efforts failed.
+            click_time = XtGetMultiClickTime(xt_disp);
+            if (click_time >= 0) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: XtGetMultiClickTime: %i.\n",
+                        __FUNCTION__, __LINE__, click_time);
+
+                successful = true;
+            }
+        }
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: %s\n",
+                __FUNCTION__, __LINE__, "XOpenDisplay failure!");
+    }
+    #endif
+
+    // Check and make sure we could connect to the x server.
+    if (properties_disp != NULL) {
+        // Try and acquire the multi-click time from the user defined X defaults.
+        if (!successful) {
+            char *xprop = XGetDefault(properties_disp, "*", "multiClickTime");
+            if (xprop != NULL && sscanf(xprop, "%4i", &click_time) != EOF) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: X default 'multiClickTime' property: %i.\n",
+                        __FUNCTION__, __LINE__, click_time);
+
+                successful = true;
+            }
+        }
+
+        if (!successful) {
+            char *xprop = XGetDefault(properties_disp, "OpenWindows", "MultiClickTimeout");
+            if (xprop != NULL && sscanf(xprop, "%4i", &click_time) != EOF) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: X default 'MultiClickTimeout' property: %i.\n",
+                        __FUNCTION__, __LINE__, click_time);
+
+                successful = true;
+            }
+        }
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: %s\n",
+                __FUNCTION__, __LINE__, "XOpenDisplay failure!");
+    }
+
+    if (successful) {
+        value = (long int) click_time;
+    }
+
+    return value;
+}
+
+// Reload the X resource database and resolve the multi-click time again.
+static void refresh_multi_click_time(Display *disp) {
+    Atom type = None;
+    int format = 0;
+    unsigned long nitems = 0, bytes_after = 0;
+    unsigned char *data = NULL;
+
+    int status = XGetWindowProperty(disp, XDefaultRootWindow(disp), XA_RESOURCE_MANAGER,
+            0L, 100000000L, False, XA_STRING, &type, &format, &nitems, &bytes_after, &data);
+
+    // A missing property produces an empty database.
+    XrmDatabase db = NULL;
+    if (status == Success && data != NULL && type == XA_STRING && format == 8) {
+        db = XrmGetStringDatabase((char *) data);
+    } else {
+        db = XrmGetStringDatabase("");
+    }
+
+    if (data != NULL) {
+        XFree(data);
+    }
+
+    pthread_mutex_lock(&click_time_mutex);
+    if (properties_disp != NULL && db != NULL) {
+        // XrmSetDatabase() does not release the database it replaces, XCloseDisplay()
+        // only releases the one installed last.
+        XrmDatabase old_db = XrmGetDatabase(properties_disp);
+        XrmSetDatabase(properties_disp, db);
+        if (old_db != NULL) {
+            XrmDestroyDatabase(old_db);
+        }
+
+        #ifdef USE_XT
+        // The X Toolkit only reads the resource at XtOpenDisplay(), so push the new value.
+        if (xt_disp != NULL) {
+            int click_time = 200;
+            char *xprop = XGetDefault(properties_disp, "*", "multiClickTime");
+            if (xprop != NULL && sscanf(xprop, "%4i", &click_time) != 1) {
+                click_time = 200;
+            }
+
+            XtSetMultiClickTime(xt_disp, click_time);
+        }
+        #endif
+    } else if (db != NULL) {
+        XrmDestroyDatabase(db);
+    }
+
+    multi_click_time = resolve_multi_click_time();
+    pthread_mutex_unlock(&click_time_mutex);
+
+    logger(LOG_LEVEL_DEBUG, "%s [%u]: Refreshed multi-click time: %li.\n",
+            __FUNCTION__, __LINE__, multi_click_time);
+}
+
+// Record an indicator change reported by XkbIndicatorStateNotify.
+static void set_indicator_state(unsigned int led_mask, Time time) {
+    pthread_mutex_lock(&indicator_mutex);
+    indicator_serial++;
+    indicator_state = led_mask;
+    indicator_time = time;
+    pthread_mutex_unlock(&indicator_mutex);
+}
+
+unsigned long get_indicator_state(unsigned int *led_mask, Time *time) {
+    pthread_mutex_lock(&indicator_mutex);
+    unsigned long serial = indicator_serial;
+    *led_mask = indicator_state;
+    *time = indicator_time;
+    pthread_mutex_unlock(&indicator_mutex);
+
+    return serial;
+}
+
+// Cache the logical button for each physical button of the core pointer.
+static void refresh_button_map(Display *disp) {
+    unsigned char map[sizeof(button_map)];
+    int count = XGetPointerMapping(disp, map, sizeof(map));
+
+    pthread_mutex_lock(&button_map_mutex);
+    memcpy(button_map, map, count);
+    button_map_count = count;
+    __atomic_store_n(&button_map_serial, button_map_serial + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&button_map_mutex);
+
+    logger(LOG_LEVEL_DEBUG, "%s [%u]: Cached %i button mapping(s).\n",
+            __FUNCTION__, __LINE__, count);
+}
+
+unsigned long get_button_map(unsigned char *map, int size, int *count) {
+    pthread_mutex_lock(&button_map_mutex);
+    unsigned long serial = button_map_serial;
+    *count = button_map_count < size ? button_map_count : size;
+    memcpy(map, button_map, *count);
+    pthread_mutex_unlock(&button_map_mutex);
+
+    return serial;
+}
+
+unsigned long get_button_map_serial() {
+    return __atomic_load_n(&button_map_serial, __ATOMIC_ACQUIRE);
+}
+
+// Let the hook know its keyboard tables and xkb state are stale.
+static void refresh_keyboard_map() {
+    __atomic_add_fetch(&keyboard_map_serial, 1, __ATOMIC_RELEASE);
+}
+
+unsigned long get_keyboard_map_serial() {
+    return __atomic_load_n(&keyboard_map_serial, __ATOMIC_ACQUIRE);
+}
+
+static void settings_cleanup_proc(void *arg) {
+    if (arg != NULL) {
+        XCloseDisplay((Display *) arg);
+    }
+}
+
+// Let on_library_load() know the settings thread is listening, or gave up.
+static void settings_thread_ready(bool running) {
+    pthread_mutex_lock(&settings_mutex);
+    settings_thread_started = true;
+    settings_thread_running = running;
+    pthread_cond_signal(&settings_cond);
+    pthread_mutex_unlock(&settings_mutex);
+}
+
+static void *settings_thread_proc(void *arg) {
+    Display *settings_disp = XOpenDisplay(XDisplayName(NULL));
+    if (settings_disp != NULL) {
+        logger(LOG_LEVEL_DEBUG, "%s [%u]: %s\n",
+                __FUNCTION__, __LINE__, "XOpenDisplay success.");
+
+        pthread_cleanup_push(settings_cleanup_proc, settings_disp);
+
+        // Root window structure changes cover screen resizes for Xinerama.
+        // Property changes report updates to the RESOURCE_MANAGER resource
+        // database.
+        Window root = XDefaultRootWindow(settings_disp);
+        XSelectInput(settings_disp, root, StructureNotifyMask | PropertyChangeMask);
+
+        // Client messages sent to a window without an event mask go to its creator only.
+        XSetWindowAttributes stop_attributes = { .event_mask = NoEventMask };
+        Window stop_window = XCreateWindow(settings_disp, root, 0, 0, 1, 1, 0, 0, InputOnly,
+                CopyFromParent, CWEventMask, &stop_attributes);
+
+        // Listen for lock indicator and keymap changes on the core keyboard.
+        int xkb_opcode, xkb_event_base, xkb_error_base;
+        int xkb_major = XkbMajorVersion, xkb_minor = XkbMinorVersion;
+        bool is_xkb = XkbQueryExtension(settings_disp, &xkb_opcode, &xkb_event_base, &xkb_error_base, &xkb_major, &xkb_minor);
+        if (is_xkb) {
+            XkbSelectEventDetails(settings_disp, XkbUseCoreKbd, XkbIndicatorStateNotify,
+                    XkbAllIndicatorsMask, XkbAllIndicatorsMask);
+            XkbSelectEvents(settings_disp, XkbUseCoreKbd, XkbNewKeyboardNotifyMask | XkbMapNotifyMask,
+                    XkbNewKeyboardNotifyMask | XkbMapNotifyMask);
+        } else {
+            logger(LOG_LEVEL_WARN, "%s [%u]: XKB is not currently available!\n",
+                    __FUNCTION__, __LINE__);
+        }
+
+        #ifdef USE_XRANDR
+        int xrandr_event_base = 0;
+        int xrandr_error_base = 0;
+        bool is_xrandr = XRRQueryExtension(settings_disp, &xrandr_event_base, &xrandr_error_base);
+        if (is_xrandr) {
+            XRRSelectInput(settings_disp, root, RRScreenChangeNotifyMask);
+        } else {
+            logger(LOG_LEVEL_WARN, "%s [%u]: XRandR is not currently available!\n",
+                    __FUNCTION__, __LINE__);
+        }
+        #endif
+
+        // Make sure the selections and the stop window exist before reporting ready.
+        XSync(settings_disp, False);
+        settings_stop_window = stop_window;
+        settings_thread_ready(true);
+
+        // Populate the initial screen layout and button mapping.
+        refresh_screen_info(settings_disp);
+        refresh_button_map(settings_disp);
+
+        XEvent ev;
+        bool running = true;
+        while (running) {
+            XNextEvent(settings_disp, &ev);
+
+            if (ev.type == ClientMessage && ev.xclient.window == stop_window && ev.xclient.message_type == settings_stop_atom) {
+                running = false;
+            } else if (is_xkb && ev.type == xkb_event_base) {
+                XkbEvent *xkb_event = (XkbEvent *) &ev;
+
+                if (xkb_event->any.xkb_type == XkbIndicatorStateNotify) {
+                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Received XkbIndicatorStateNotify. (%#X)\n",
+                            __FUNCTION__, __LINE__, xkb_event->indicators.state);
+
+                    set_indicator_state(xkb_event->indicators.state, xkb_event->indicators.time);
+                } else if (xkb_event->any.xkb_type == XkbNewKeyboardNotify || xkb_event->any.xkb_type == XkbMapNotify) {
+                    logger(LOG_LEVEL_DEBUG, "%s [%u]: Received %s.\n",
+                            __FUNCTION__, __LINE__, xkb_event->any.xkb_type == XkbMapNotify ? "XkbMapNotify" : "XkbNewKeyboardNotify");
+
+                    refresh_keyboard_map();
+                }
+            } else if (ev.type == PropertyNotify && ev.xproperty.atom == XA_RESOURCE_MANAGER) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Received RESOURCE_MANAGER PropertyNotify.\n",
+                        __FUNCTION__, __LINE__);
+
+                refresh_multi_click_time(settings_disp);
+            } else if (ev.type == MappingNotify && ev.xmapping.request == MappingPointer) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Received pointer MappingNotify.\n",
+                        __FUNCTION__, __LINE__);
+
+                refresh_button_map(settings_disp);
+            } else if (ev.type == MappingNotify) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Received keyboard MappingNotify.\n",
+                        __FUNCTION__, __LINE__);
+
+                // Servers without XKB only report keymap changes this way.
+                XRefreshKeyboardMapping(&ev.xmapping);
+                refresh_keyboard_map();
+            } else if (ev.type == ConfigureNotify) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Received root ConfigureNotify.\n",
+                        __FUNCTION__, __LINE__);
+
+                refresh_screen_info(settings_disp);
+            }
+            #ifdef USE_XRANDR
+            else if (is_xrandr && ev.type == xrandr_event_base + RRScreenChangeNotify) {
+                logger(LOG_LEVEL_DEBUG, "%s [%u]: Received XRRScreenChangeNotifyEvent.\n",
+                        __FUNCTION__, __LINE__);
+
+                XRRUpdateConfiguration(&ev);
+                refresh_screen_info(settings_disp);
+            }
+            #endif
+        }
+
+        XDestroyWindow(settings_disp, stop_window);
+
+        // Execute the thread cleanup handler.
+        pthread_cleanup_pop(1);
+    } else {
+        logger(LOG_LEVEL_ERROR, "%s [%u]: XOpenDisplay failure!\n",
+                __FUNCTION__, __LINE__);
+
+        settings_thread_ready(false);
+    }
+
+    return NULL;
+}
+
+UIOHOOK_API screen_data* hook_create_screen_info(unsigned char *count) {
+    *count = 0;
+    screen_data *screens = NULL;
+
+    pthread_mutex_lock(&screen_mutex);
+    if (screen_cache != NULL) {
+        screens = malloc(sizeof(screen_data) * screen_cache_count);
+
+        if (screens != NULL) {
+            memcpy(screens, screen_cache, sizeof(screen_data) * screen_cache_count);
+            *count = screen_cache_count;
+        }
+    }
+    pthread_mutex_unlock(&screen_mutex);
+
+    // Fallback to a direct query if the settings thread has not populated the cache.
+    if (screens == NULL && properties_disp != NULL) {
+        screens = query_screen_info(properties_disp, count);
+    }
+
     return screens;
 }
 
+bool get_screen_origin(int16_t *x, int16_t *y) {
+    bool is_multi_head = false;
+
+    pthread_mutex_lock(&screen_mutex);
+    if (screen_cache != NULL && screen_cache_count > 1) {
+        *x = screen_cache[0].x;
+        *y = screen_cache[0].y;
+
+        is_multi_head = true;
+    }
+    pthread_mutex_unlock(&screen_mutex);
+
+    return is_multi_head;
+}
+
 UIOHOOK_API long int hook_get_auto_repeat_rate() {
     bool successful = false;
     long int value = -1;
@@ -366,60 +718,13 @@ UIOHOOK_API long int hook_get_pointer_sensitivity() {
 }
 
 UIOHOOK_API long int hook_get_multi_click_time() {
-    long int value = 200;
-    int click_time;
-    bool successful = false;
-
-    #ifdef USE_XT
-    // Check and make sure we could connect to the x server.
-    if (xt_disp != NULL) {
-        // Try and use the Xt extention to get the current multi-click.
-        if (!successful) {
-            // Fall back to the X Toolkit extension if available and other efforts failed.
-            click_time = XtGetMultiClickTime(xt_disp);
-            if (click_time >= 0) {
-                logger(LOG_LEVEL_DEBUG, "%s [%u]: XtGetMultiClickTime: %i.\n",
-                        __FUNCTION__, __LINE__, click_time);
-
-                successful = true;
-            }
-        }
-    } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: %s\n",
-                __FUNCTION__, __LINE__, "XOpenDisplay failure!");
-    }
-    #endif
-
-    // Check and make sure we could connect to the x server.
-    if (properties_disp != NULL) {
-        // Try and acquire the multi-click time from the user defined X defaults.
-        if (!successful) {
-            char *xprop = XGetDefault(properties_disp, "*", "multiClickTime");
-            if (xprop != NULL && sscanf(xprop, "%4i", &click_time) != EOF) {
-                logger(LOG_LEVEL_DEBUG, "%s [%u]: X default 'multiClickTime' property: %i.\n",
-                        __FUNCTION__, __LINE__, click_time);
-
-                successful = true;
-            }
-        }
-
-        if (!successful) {
-            char *xprop = XGetDefault(properties_disp, "OpenWindows", "MultiClickTimeout");
-            if (xprop != NULL && sscanf(xprop, "%4i", &click_time) != EOF) {
-                logger(LOG_LEVEL_DEBUG, "%s [%u]: X default 'MultiClickTimeout' property: %i.\n",
-                        __FUNCTION__, __LINE__, click_time);
-
-                successful = true;
-            }
-        }
-    } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: %s\n",
-                __FUNCTION__, __LINE__, "XOpenDisplay failure!");
+    pthread_mutex_lock(&click_time_mutex);
+    if (multi_click_time < 0) {
+        multi_click_time = resolve_multi_click_time();
     }
 
-    if (successful) {
-        value = (long int) click_time;
-    }
+    long int value = multi_click_time;
+    pthread_mutex_unlock(&click_time_mutex);
 
     return value;
 }
@@ -440,24 +745,6 @@ void on_library_load() {
                 __FUNCTION__, __LINE__, "XOpenDisplay success.");
     }
 
-    #ifdef USE_XRANDR
-    // Create the thread attribute.
-    pthread_attr_t settings_thread_attr;
-    pthread_attr_init(&settings_thread_attr);
-
-    pthread_t settings_thread_id;
-    if (pthread_create(&settings_thread_id, &settings_thread_attr, settings_thread_proc, NULL) == 0) {
-        logger(LOG_LEVEL_DEBUG, "%s [%u]: Successfully created settings thread.\n",
-                __FUNCTION__, __LINE__);
-    } else {
-        logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to create settings thread!\n",
-                __FUNCTION__, __LINE__);
-    }
-
-    // Make sure the thread attribute is removed.
-    pthread_attr_destroy(&settings_thread_attr);
-    #endif
-
     #ifdef USE_XT
     XtToolkitInitialize();
     xt_context = XtCreateApplicationContext();
@@ -467,6 +754,41 @@ void on_library_load() {
     xt_disp = XtOpenDisplay(xt_context, NULL, "UIOHook", "libuiohook", NULL, 0, &argc, argv);
     #endif
 
+    // Resolve the multi-click time once so the hook never has to.
+    pthread_mutex_lock(&click_time_mutex);
+    multi_click_time = resolve_multi_click_time();
+    pthread_mutex_unlock(&click_time_mutex);
+
+    if (properties_disp != NULL) {
+        settings_stop_atom = XInternAtom(properties_disp, "_UIOHOOK_SETTINGS_STOP", False);
+
+        // Create the thread attribute.
+        pthread_attr_t settings_thread_attr;
+        pthread_attr_init(&settings_thread_attr);
+
+        pthread_mutex_lock(&settings_mutex);
+        if (pthread_create(&settings_thread_id, &settings_thread_attr, settings_thread_proc, NULL) == 0) {
+            logger(LOG_LEVEL_DEBUG, "%s [%u]: Successfully created settings thread.\n",
+                    __FUNCTION__, __LINE__);
+
+            // Wait for the settings thread to start listening.
+            while (!settings_thread_started) {
+                pthread_cond_wait(&settings_cond, &settings_mutex);
+            }
+
+            if (!settings_thread_running) {
+                pthread_join(settings_thread_id, NULL);
+            }
+        } else {
+            logger(LOG_LEVEL_ERROR, "%s [%u]: Failed to create settings thread!\n",
+                    __FUNCTION__, __LINE__);
+        }
+        pthread_mutex_unlock(&settings_mutex);
+
+        // Make sure the thread attribute is removed.
+        pthread_attr_destroy(&settings_thread_attr);
+    }
+
     // Initialize.
     load_input_helper(properties_disp);
 }
@@ -477,11 +799,42 @@ void on_library_unload() {
     // Disable the event hook.
     //hook_stop();
 
+    // Wake the settings thread with a stop message and wait for it to exit.
+    if (settings_thread_running) {
+        XEvent stop_event;
+        memset(&stop_event, 0, sizeof(XEvent));
+        stop_event.xclient.type = ClientMessage;
+        stop_event.xclient.window = settings_stop_window;
+        stop_event.xclient.message_type = settings_stop_atom;
+        stop_event.xclient.format = 32;
+
+        XSendEvent(properties_disp, settings_stop_window, False, NoEventMask, &stop_event);
+        XFlush(properties_disp);
+
+        pthread_join(settings_thread_id, NULL);
+        settings_thread_started = false;
+        settings_thread_running = false;
+        settings_stop_window = None;
+    }
+
+    pthread_mutex_lock(&screen_mutex);
+    if (screen_cache != NULL) {
+        free(screen_cache);
+        screen_cache = NULL;
+    }
+    screen_cache_count = 0;
+    pthread_mutex_unlock(&screen_mutex);
+
+    // Stop posting before the input helper goes away.
+    unload_post_thread();
+
     // Cleanup.
     unload_input_helper();
 
     #ifdef USE_XT
-    XtCloseDisplay(xt_disp);
+    if (xt_disp != NULL) {
+        XtCloseDisplay(xt_disp);
+    }
     XtDestroyApplicationContext(xt_context);
     #endif
 
@@ -490,4 +843,5 @@ void on_library_unload() {
         XCloseDisplay(properties_disp);
         properties_disp = NULL;
     }
+    multi_click_time = -1;
 }
@@ -0,0 +1,286 @@
+/* libUIOHook: Cross-platform keyboard and mouse hooking from userland.
+ * Copyright (C) 2006-2020 Alexander Barker.  All Rights Received.
+ * https://github.com/kwhat/libuiohook/
+ *
+ * libUIOHook is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libUIOHook is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <uiohook.h>
+
+#include "minunit.h"
+
+// Feeds an event to the dispatcher the same way the hook thread does.
+extern void dispatch_event(uiohook_event *const event);
+
+static void dispatch_motion(int16_t x, uint64_t time) {
+    uiohook_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_MOUSE_MOVED;
+    event.time = time;
+    event.data.mouse.x = x;
+
+    dispatch_event(&event);
+}
+
+/* Make sure the poll queue keeps its order when the indexes wrap */
+static char * test_ring_wrap() {
+    mu_assert("error, could not set DISPATCH_MODE_POLL", hook_set_dispatch_mode(DISPATCH_MODE_POLL, 4) == UIOHOOK_SUCCESS);
+    hook_set_coalescing(0x00, 0, 0);
+
+    uiohook_event buffer[8];
+    for (int16_t i = 0; i < 3; i++) {
+        dispatch_motion(i, 0);
+    }
+    mu_assert("error, poll did not return the queued events", hook_poll_events(buffer, 8, 0) == 3);
+
+    // Head and tail are now 3, so these occupy slots 3, 0, 1 and 2.
+    for (int16_t i = 3; i < 7; i++) {
+        dispatch_motion(i, 0);
+    }
+
+    size_t count = hook_poll_events(buffer, 8, 0);
+    fprintf(stdout, "Polled %zu event(s) across the wrap\n", count);
+    mu_assert("error, poll did not return every event across the wrap", count == 4);
+    for (size_t i = 0; i < count; i++) {
+        mu_assert("error, events across the wrap are out of order", buffer[i].data.mouse.x == (int16_t) (3 + i));
+    }
+
+    mu_assert("error, could not restore DISPATCH_MODE_SYNC", hook_set_dispatch_mode(DISPATCH_MODE_SYNC, 0) == UIOHOOK_SUCCESS);
+
+    return NULL;
+}
+
+/* Make sure a full poll queue drops new events and counts them */
+static char * test_ring_overflow() {
+    mu_assert("error, could not set DISPATCH_MODE_POLL", hook_set_dispatch_mode(DISPATCH_MODE_POLL, 4) == UIOHOOK_SUCCESS);
+    hook_set_coalescing(0x00, 0, 0);
+
+    for (int16_t i = 0; i < 6; i++) {
+        dispatch_motion(i, 0);
+    }
+
+    dispatch_stats stats;
+    hook_get_dispatch_stats(&stats);
+    fprintf(stdout, "Capacity %u, occupancy %u, overflow %llu\n",
+            stats.capacity, stats.occupancy, (unsigned long long) stats.overflow);
+    mu_assert("error, unexpected ring capacity", stats.capacity == 4);
+    mu_assert("error, unexpected ring occupancy", stats.occupancy == 4);
+    mu_assert("error, dropped events were not counted", stats.overflow == 2);
+
+    // The oldest events are kept, the ones that did not fit are dropped.
+    uiohook_event buffer[8];
+    size_t count = hook_poll_events(buffer, 8, 0);
+    mu_assert("error, poll did not return the queued events", count == 4);
+    for (size_t i = 0; i < count; i++) {
+        mu_assert("error, the wrong events were dropped", buffer[i].data.mouse.x == (int16_t) i);
+    }
+
+    mu_assert("error, could not restore DISPATCH_MODE_SYNC", hook_set_dispatch_mode(DISPATCH_MODE_SYNC, 0) == UIOHOOK_SUCCESS);
+
+    return NULL;
+}
+
+// Events returned to the blocked poller.
+static size_t polled_count;
+
+static void * poll_thread_proc(void *arg) {
+    uiohook_event buffer[8];
+    polled_count = hook_poll_events(buffer, 8, 5000);
+
+    return NULL;
+}
+
+/* Make sure the poll queue cannot be released while another thread is polling it */
+static char * test_poll_blocks_mode_change() {
+    mu_assert("error, could not set DISPATCH_MODE_POLL", hook_set_dispatch_mode(DISPATCH_MODE_POLL, 4) == UIOHOOK_SUCCESS);
+    hook_set_coalescing(0x00, 0, 0);
+
+    pthread_t poll_thread;
+    mu_assert("error, could not start the polling thread", pthread_create(&poll_thread, NULL, poll_thread_proc, NULL) == 0);
+
+    // Give the poller time to park on the empty queue.
+    struct timespec delay = { 0, 100 * 1000 * 1000 };
+    nanosleep(&delay, NULL);
+
+    int status = hook_set_dispatch_mode(DISPATCH_MODE_SYNC, 0);
+    dispatch_motion(1, 0);
+    pthread_join(poll_thread, NULL);
+
+    fprintf(stdout, "Mode change while polling returned %#X, poller got %zu event(s)\n", status, polled_count);
+    mu_assert("error, the dispatch mode changed while another thread was polling", status == UIOHOOK_FAILURE);
+    mu_assert("error, the poller did not receive the event", polled_count == 1);
+
+    mu_assert("error, could not restore DISPATCH_MODE_SYNC", hook_set_dispatch_mode(DISPATCH_MODE_SYNC, 0) == UIOHOOK_SUCCESS);
+
+    return NULL;
+}
+
+// Calls seen by the subscriber test callbacks.
+static unsigned int first_calls, second_calls, late_calls;
+
+static void late_subscriber(uiohook_event * const event, void *capture) {
+    late_calls++;
+}
+
+static void second_subscriber(uiohook_event * const event, void *capture) {
+    second_calls++;
+}
+
+// Replaces the second subscriber with the late one while the first event is dispatched.
+static void first_subscriber(uiohook_event * const event, void *capture) {
+    if (first_calls++ == 0) {
+        hook_remove_dispatch_proc(second_subscriber, NULL);
+        hook_add_dispatch_proc(late_subscriber, NULL, EVENT_MASK_MOUSE);
+    }
+}
+
+/* Make sure subscribers added and removed during dispatch take effect with the next event */
+static char * test_subscribers_during_dispatch() {
+    first_calls = 0;
+    second_calls = 0;
+    late_calls = 0;
+
+    mu_assert("error, could not add the first subscriber", hook_add_dispatch_proc(first_subscriber, NULL, EVENT_MASK_ALL) == UIOHOOK_SUCCESS);
+    mu_assert("error, could not add the second subscriber", hook_add_dispatch_proc(second_subscriber, NULL, EVENT_MASK_ALL) == UIOHOOK_SUCCESS);
+
+    // The snapshot taken for this event still holds the removed subscriber.
+    dispatch_motion(0, 0);
+    mu_assert("error, the first subscriber was not called", first_calls == 1);
+    mu_assert("error, a removed subscriber missed the event in progress", second_calls == 1);
+    mu_assert("error, an added subscriber saw the event in progress", late_calls == 0);
+
+    dispatch_motion(1, 0);
+    mu_assert("error, the first subscriber was not called again", first_calls == 2);
+    mu_assert("error, a removed subscriber was called", second_calls == 1);
+    mu_assert("error, an added subscriber was not called", late_calls == 1);
+
+    // Subscribers only see the event types in their mask.
+    mu_assert("error, could not change the late subscriber mask", hook_add_dispatch_proc(late_subscriber, NULL, EVENT_MASK_KEYBOARD) == UIOHOOK_SUCCESS);
+    dispatch_motion(2, 0);
+    mu_assert("error, a subscriber was called outside its mask", late_calls == 1);
+
+    mu_assert("error, could not remove the first subscriber", hook_remove_dispatch_proc(first_subscriber, NULL) == UIOHOOK_SUCCESS);
+    mu_assert("error, could not remove the late subscriber", hook_remove_dispatch_proc(late_subscriber, NULL) == UIOHOOK_SUCCESS);
+    mu_assert("error, removed a subscriber twice", hook_remove_dispatch_proc(second_subscriber, NULL) == UIOHOOK_FAILURE);
+
+    return NULL;
+}
+
+static void dispatch_wheel(int16_t rotation, uint64_t time) {
+    uiohook_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_MOUSE_WHEEL;
+    event.time = time;
+    event.data.wheel.type = WHEEL_UNIT_SCROLL;
+    event.data.wheel.amount = 3;
+    event.data.wheel.rotation = rotation;
+    event.data.wheel.direction = WHEEL_VERTICAL_DIRECTION;
+
+    dispatch_event(&event);
+}
+
+static void dispatch_key(uint16_t keycode) {
+    uiohook_event event;
+    memset(&event, 0, sizeof(event));
+    event.type = EVENT_KEY_PRESSED;
+    event.data.keyboard.keycode = keycode;
+
+    dispatch_event(&event);
+}
+
+/* Make sure runs of motion and wheel events merge without crossing other events */
+static char * test_coalesce_runs() {
+    mu_assert("error, could not set DISPATCH_MODE_POLL", hook_set_dispatch_mode(DISPATCH_MODE_POLL, 16) == UIOHOOK_SUCCESS);
+    hook_set_coalescing(COALESCE_MOUSE_MOTION | COALESCE_MOUSE_WHEEL, 0, 0);
+
+    dispatch_motion(1, 0);
+    dispatch_motion(2, 0);
+    dispatch_motion(3, 0);
+    dispatch_key(VC_A);
+    dispatch_motion(4, 0);
+    dispatch_wheel(1, 0);
+    dispatch_wheel(2, 0);
+    dispatch_wheel(-1, 0);
+    dispatch_wheel(-1, 0);
+
+    uiohook_event buffer[16];
+    size_t count = hook_poll_events(buffer, 16, 0);
+    fprintf(stdout, "Coalesced 9 events into %zu\n", count);
+    mu_assert("error, unexpected number of coalesced events", count == 5);
+
+    mu_assert("error, motion did not keep the latest position", buffer[0].type == EVENT_MOUSE_MOVED && buffer[0].data.mouse.x == 3);
+    mu_assert("error, motion was merged across a key event", buffer[1].type == EVENT_KEY_PRESSED && buffer[2].data.mouse.x == 4);
+    mu_assert("error, wheel rotation was not summed", buffer[3].type == EVENT_MOUSE_WHEEL && buffer[3].data.wheel.rotation == 3);
+    mu_assert("error, wheel was merged across a change of direction", buffer[4].type == EVENT_MOUSE_WHEEL && buffer[4].data.wheel.rotation == -2);
+
+    hook_set_coalescing(0x00, 0, 0);
+    mu_assert("error, could not restore DISPATCH_MODE_SYNC", hook_set_dispatch_mode(DISPATCH_MODE_SYNC, 0) == UIOHOOK_SUCCESS);
+
+    return NULL;
+}
+
+/* Make sure the window and event limits end a run */
+static char * test_coalesce_limits() {
+    mu_assert("error, could not set DISPATCH_MODE_POLL", hook_set_dispatch_mode(DISPATCH_MODE_POLL, 16) == UIOHOOK_SUCCESS);
+
+    uiohook_event buffer[16];
+
+    // Events more than 10 ms after the first of a run start a new run.
+    hook_set_coalescing(COALESCE_MOUSE_MOTION, 10, 0);
+    dispatch_motion(1, 100);
+    dispatch_motion(2, 105);
+    dispatch_motion(3, 110);
+    dispatch_motion(4, 111);
+    size_t count = hook_poll_events(buffer, 16, 0);
+    mu_assert("error, the window did not end the run", count == 2);
+    mu_assert("error, the window kept the wrong positions", buffer[0].data.mouse.x == 3 && buffer[1].data.mouse.x == 4);
+
+    // At most two events are merged into one.
+    hook_set_coalescing(COALESCE_MOUSE_MOTION, 0, 2);
+    for (int16_t i = 1; i <= 5; i++) {
+        dispatch_motion(i, 0);
+    }
+    count = hook_poll_events(buffer, 16, 0);
+    mu_assert("error, the event limit did not end the run", count == 3);
+    mu_assert("error, the event limit kept the wrong positions", buffer[0].data.mouse.x == 2 && buffer[1].data.mouse.x == 4 && buffer[2].data.mouse.x == 5);
+
+    // Wheel events are left alone unless asked for.
+    dispatch_wheel(1, 0);
+    dispatch_wheel(1, 0);
+    count = hook_poll_events(buffer, 16, 0);
+    mu_assert("error, wheel events were merged without COALESCE_MOUSE_WHEEL", count == 2);
+
+    hook_set_coalescing(0x00, 0, 0);
+    mu_assert("error, could not restore DISPATCH_MODE_SYNC", hook_set_dispatch_mode(DISPATCH_MODE_SYNC, 0) == UIOHOOK_SUCCESS);
+
+    return NULL;
+}
+
+char * input_hook_tests() {
+    mu_run_test(test_ring_wrap);
+    mu_run_test(test_ring_overflow);
+    mu_run_test(test_poll_blocks_mode_change);
+
+    mu_run_test(test_subscribers_during_dispatch);
+
+    mu_run_test(test_coalesce_runs);
+    mu_run_test(test_coalesce_limits);
+
+    return NULL;
+}
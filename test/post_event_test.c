@@ -0,0 +1,194 @@
+/* libUIOHook: Cross-platform keyboard and mouse hooking from userland.
+ * Copyright (C) 2006-2020 Alexander Barker.  All Rights Received.
+ * https://github.com/kwhat/libuiohook/
+ *
+ * libUIOHook is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * libUIOHook is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <uiohook.h>
+
+#include "minunit.h"
+
+// Decodes the UTF-8 sequence at the cursor for hook_post_text().
+extern uint32_t decode_utf8(const unsigned char **cursor);
+
+// Decode a whole string, returning the number of code points written to buffer.
+static size_t decode_string(const char *utf8, uint32_t *buffer, size_t size) {
+    const unsigned char *cursor = (const unsigned char *) utf8;
+
+    size_t count = 0;
+    while (*cursor != '\0' && count < size) {
+        buffer[count++] = decode_utf8(&cursor);
+    }
+
+    return count;
+}
+
+/* Make sure well formed sequences of every length decode */
+static char * test_decode_utf8_valid() {
+    uint32_t buffer[8];
+
+    size_t count = decode_string("a\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", buffer, 8);
+    mu_assert("error, unexpected number of code points", count == 4);
+    mu_assert("error, failed to decode a one byte sequence", buffer[0] == 'a');
+    mu_assert("error, failed to decode a two byte sequence", buffer[1] == 0xE9);
+    mu_assert("error, failed to decode a three byte sequence", buffer[2] == 0x20AC);
+    mu_assert("error, failed to decode a four byte sequence", buffer[3] == 0x1F600);
+
+    // The smallest and largest code point of each length.
+    count = decode_string("\xc2\x80\xdf\xbf\xe0\xa0\x80\xef\xbf\xbf\xf0\x90\x80\x80\xf4\x8f\xbf\xbf", buffer, 8);
+    mu_assert("error, unexpected number of boundary code points", count == 6);
+    mu_assert("error, failed to decode U+0080", buffer[0] == 0x80);
+    mu_assert("error, failed to decode U+07FF", buffer[1] == 0x7FF);
+    mu_assert("error, failed to decode U+0800", buffer[2] == 0x800);
+    mu_assert("error, failed to decode U+FFFF", buffer[3] == 0xFFFF);
+    mu_assert("error, failed to decode U+10000", buffer[4] == 0x10000);
+    mu_assert("error, failed to decode U+10FFFF", buffer[5] == 0x10FFFF);
+
+    return NULL;
+}
+
+/* Make sure overlong forms are rejected a byte at a time */
+static char * test_decode_utf8_overlong() {
+    uint32_t buffer[8];
+
+    // '/' encoded with two, three and four bytes.
+    const char *overlongs[] = { "\xc0\xaf", "\xe0\x80\xaf", "\xf0\x80\x80\xaf" };
+    for (size_t i = 0; i < sizeof(overlongs) / sizeof(overlongs[0]); i++) {
+        size_t count = decode_string(overlongs[i], buffer, 8);
+        fprintf(stdout, "Overlong form %zu decoded into %zu code point(s)\n", i + 2, count);
+        mu_assert("error, an overlong form did not consume one byte per code point", count == i + 2);
+        for (size_t j = 0; j < count; j++) {
+            mu_assert("error, an overlong form was accepted", buffer[j] == 0xFFFD);
+        }
+    }
+
+    // U+07FF and U+FFFF encoded one byte longer than needed.
+    mu_assert("error, an overlong three byte form was accepted", decode_string("\xe0\x9f\xbf", buffer, 8) == 3 && buffer[0] == 0xFFFD);
+    mu_assert("error, an overlong four byte form was accepted", decode_string("\xf0\x8f\xbf\xbf", buffer, 8) == 4 && buffer[0] == 0xFFFD);
+
+    return NULL;
+}
+
+/* Make sure UTF-16 surrogates and code points past U+10FFFF are rejected */
+static char * test_decode_utf8_out_of_range() {
+    uint32_t buffer[8];
+
+    mu_assert("error, the first surrogate was accepted", decode_string("\xed\xa0\x80", buffer, 8) == 3 && buffer[0] == 0xFFFD);
+    mu_assert("error, the last surrogate was accepted", decode_string("\xed\xbf\xbf", buffer, 8) == 3 && buffer[0] == 0xFFFD);
+    mu_assert("error, the code point before the surrogates was rejected", decode_string("\xed\x9f\xbf", buffer, 8) == 1 && buffer[0] == 0xD7FF);
+    mu_assert("error, the code point after the surrogates was rejected", decode_string("\xee\x80\x80", buffer, 8) == 1 && buffer[0] == 0xE000);
+    mu_assert("error, U+110000 was accepted", decode_string("\xf4\x90\x80\x80", buffer, 8) == 4 && buffer[0] == 0xFFFD);
+
+    // A truncated sequence must not read past the terminator.
+    size_t count = decode_string("\xe2\x82", buffer, 8);
+    mu_assert("error, a truncated sequence was accepted", count == 2 && buffer[0] == 0xFFFD && buffer[1] == 0xFFFD);
+
+    return NULL;
+}
+
+// Path sampling helpers for hook_post_mouse_path().
+extern int64_t get_path_sample_time(uint64_t i, uint64_t samples, uint32_t duration_ms);
+extern double * build_path_lengths(const path_point *points, size_t count);
+extern path_point get_path_point(const path_point *points, size_t count, uint8_t type,
+        const double *lengths, double *scratch, double t);
+
+/* Make sure sample times are exact for short paths and do not overflow for long ones */
+static char * test_path_sample_time() {
+    for (uint64_t samples = 1; samples <= 64; samples++) {
+        for (uint64_t i = 0; i <= samples; i++) {
+            mu_assert("error, unexpected sample time for a short path",
+                    get_path_sample_time(i, samples, 1000) == (int64_t) (i * 1000 * 1000000 / samples));
+        }
+    }
+
+    // Six hours at 1 kHz is one sample per millisecond, i * duration_ms * 1000000 is past 2^64 here.
+    uint32_t duration_ms = 6 * 60 * 60 * 1000;
+    uint64_t samples = duration_ms;
+    fprintf(stdout, "Last sample of a %u ms path at %" PRId64 " ns\n",
+            duration_ms, get_path_sample_time(samples, samples, duration_ms));
+    mu_assert("error, the first sample of a long path is not at the start", get_path_sample_time(0, samples, duration_ms) == 0);
+    mu_assert("error, the middle sample of a long path is misplaced", get_path_sample_time(samples / 2, samples, duration_ms) == (int64_t) duration_ms * 500000);
+    mu_assert("error, the last sample of a long path is not at the end", get_path_sample_time(samples, samples, duration_ms) == (int64_t) duration_ms * 1000000);
+
+    int64_t previous = get_path_sample_time(samples - 1000, samples, duration_ms);
+    for (uint64_t i = samples - 999; i <= samples; i++) {
+        int64_t time = get_path_sample_time(i, samples, duration_ms);
+        mu_assert("error, the samples of a long path are not 1 ms apart", time - previous >= 999999 && time - previous <= 1000001);
+        previous = time;
+    }
+
+    return NULL;
+}
+
+/* Make sure polylines are sampled at constant speed along their segments */
+static char * test_path_polyline() {
+    path_point points[3] = { { 0, 0 }, { 100, 0 }, { 100, 100 } };
+
+    double *lengths = build_path_lengths(points, 3);
+    mu_assert("error, could not build the path lengths", lengths != NULL);
+    mu_assert("error, unexpected segment lengths", lengths[0] == 0 && lengths[1] == 100 && lengths[2] == 200);
+
+    const double t[5] = { 0, 0.25, 0.5, 0.75, 1 };
+    const path_point expected[5] = { { 0, 0 }, { 50, 0 }, { 100, 0 }, { 100, 50 }, { 100, 100 } };
+    for (size_t i = 0; i < 5; i++) {
+        path_point point = get_path_point(points, 3, PATH_POLYLINE, lengths, NULL, t[i]);
+        mu_assert("error, unexpected point on the polyline", point.x == expected[i].x && point.y == expected[i].y);
+    }
+    free(lengths);
+
+    // A path that does not move stays on its first point.
+    path_point still[2] = { { 7, -7 }, { 7, -7 } };
+    lengths = build_path_lengths(still, 2);
+    mu_assert("error, could not build the path lengths", lengths != NULL);
+    path_point point = get_path_point(still, 2, PATH_POLYLINE, lengths, NULL, 0.5);
+    mu_assert("error, a path without length moved", point.x == 7 && point.y == -7);
+    free(lengths);
+
+    return NULL;
+}
+
+/* Make sure Bezier paths pass through their end points and curve toward the others */
+static char * test_path_bezier() {
+    path_point points[3] = { { 0, 0 }, { 50, 100 }, { 100, 0 } };
+    double scratch[6];
+
+    path_point point = get_path_point(points, 3, PATH_BEZIER, NULL, scratch, 0);
+    mu_assert("error, the curve does not start on the first point", point.x == 0 && point.y == 0);
+
+    point = get_path_point(points, 3, PATH_BEZIER, NULL, scratch, 0.5);
+    mu_assert("error, unexpected point in the middle of the curve", point.x == 50 && point.y == 50);
+
+    point = get_path_point(points, 3, PATH_BEZIER, NULL, scratch, 1);
+    mu_assert("error, the curve does not end on the last point", point.x == 100 && point.y == 0);
+
+    return NULL;
+}
+
+char * post_event_tests() {
+    mu_run_test(test_decode_utf8_valid);
+    mu_run_test(test_decode_utf8_overlong);
+    mu_run_test(test_decode_utf8_out_of_range);
+
+    mu_run_test(test_path_sample_time);
+    mu_run_test(test_path_polyline);
+    mu_run_test(test_path_bezier);
+
+    return NULL;
+}
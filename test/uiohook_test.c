@@ -28,6 +28,11 @@
 extern char * system_properties_tests();
 extern char * input_helper_tests();
 
+#if !defined(__APPLE__) && !defined(__MACH__) && !defined(_WIN32)
+extern char * input_hook_tests();
+extern char * post_event_tests();
+#endif
+
 #if !defined(__APPLE__) && !defined(__MACH__) && !defined(_WIN32)
 static Display *disp;
 #endif
@@ -67,6 +72,11 @@ static char * all_tests() {
     mu_run_test(system_properties_tests);
     mu_run_test(input_helper_tests);
 
+    #if !defined(__APPLE__) && !defined(__MACH__) && !defined(_WIN32)
+    mu_run_test(input_hook_tests);
+    mu_run_test(post_event_tests);
+    #endif
+
     mu_run_test(cleanup_tests);
 
     return NULL;